@@ -115,6 +115,15 @@ void
 microdelay(int us) {
 }
 
+// Send interrupt vector to the CPU with local APIC apicid.
+// Caller has interrupts off, ICRHI and ICRLO go together.
+void
+lapicipi(uint8 apicid, int vector) {
+    lapicw(ICRHI, apicid << 24);
+    lapicw(ICRLO, vector);
+    while (lapic[ICRLO] & DELIVS);
+}
+
 #define CMOS_PORT    0x70
 #define CMOS_RETURN  0x71
 
@@ -0,0 +1,102 @@
+// Physical memory detection.
+//
+// bootasm.S asks the BIOS for the E820 memory map before it leaves
+// real mode and leaves it at E820MAP. e820init reads it to find out
+// where memory ends (phystop), which bounds the kernel's direct map,
+// and kinit2 frees only the parts of memory the map says are usable.
+//
+// The kernel maps physical memory at KERNBASE, so anything above
+// PHYSLIMIT is left alone. Without a map we fall back to PHYSTOP.
+
+#include "../../../../user/types.h"
+#include "../../../defs/defs.h"
+#include "memlayout.h"
+#include "mmu.h"
+
+#define E820_RAM 1  // usable memory, other types are reserved
+
+struct e820entry {
+  uint64 addr;
+  uint64 len;
+  uint32 type;
+} __attribute__((packed));
+
+struct e820map {
+  uint32 nr;
+  struct e820entry map[E820MAX];
+};
+
+uint32 phystop;  // end of the memory the kernel maps and allocates
+
+// Clip entry e to [0, PHYSLIMIT) as 32-bit addresses.
+// Returns 0 if it is not usable memory or nothing is left.
+static int
+e820clip(struct e820entry *e, uint32 *start, uint32 *end)
+{
+  uint64 s = e->addr, t = e->addr + e->len;
+
+  if(e->type != E820_RAM)
+    return 0;
+  if(t > PHYSLIMIT)
+    t = PHYSLIMIT;
+  if(s >= t)
+    return 0;
+  *start = PGROUNDUP((uint32)s);
+  *end = PGROUNDDOWN((uint32)t);
+  return *start < *end;
+}
+
+// Runs first thing in main, while entrypgdir still maps the map.
+void
+e820init(void)
+{
+  struct e820map *m = P2V(E820MAP);
+  struct e820entry *e;
+  uint32 start, end;
+
+  if(m->nr == 0 || m->nr > E820MAX){
+    // an old BIOS, assume the memory xv6 always assumed
+    m->nr = 1;
+    m->map[0].addr = EXTMEM;
+    m->map[0].len = PHYSTOP - EXTMEM;
+    m->map[0].type = E820_RAM;
+  }
+  for(e = m->map; e < &m->map[m->nr]; e++)
+    if(e820clip(e, &start, &end) && end > phystop)
+      phystop = end;
+}
+
+// Is physical [start, end) inside one usable region?
+int
+e820usable(uint32 start, uint32 end)
+{
+  struct e820map *m = P2V(E820MAP);
+  struct e820entry *e;
+  uint32 s, t;
+
+  for(e = m->map; e < &m->map[m->nr]; e++)
+    if(e820clip(e, &s, &t) && s <= start && end <= t)
+      return 1;
+  return 0;
+}
+
+// Call f on the usable parts of physical [start, end),
+// as kernel virtual addresses.
+void
+e820free(uint32 start, uint32 end, void (*f)(void*, void*))
+{
+  struct e820map *m = P2V(E820MAP);
+  struct e820entry *e;
+  uint32 s, t;
+
+  for(e = m->map; e < &m->map[m->nr]; e++){
+    if(!e820clip(e, &s, &t))
+      continue;
+    if(s < start)
+      s = start;
+    if(t > end)
+      t = end;
+    if(s < t)
+      f(P2V(s), P2V(t));
+  }
+}
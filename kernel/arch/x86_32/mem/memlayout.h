@@ -1,13 +1,31 @@
 // Memory layout
 
 #define EXTMEM  0x100000            // Start of extended memory
-#define PHYSTOP 0xE000000           // Top physical memory
+#define PHYSTOP 0xE000000           // Top physical memory if the BIOS has no E820 map (see e820.c)
 #define DEVSPACE 0xFE000000         // Other devices are at high addresses
+#define PHYSLIMIT (DEVSPACE - KERNBASE) // Memory above this can't be mapped at KERNBASE, so isn't used
+
+// The boot loader leaves the BIOS memory map here: a count, then up to E820MAX entries.
+#define E820MAP 0x8000
+#define E820MAX 32
 
 // Key addresses for address space layout (see kmap in vm.c for layout)
 #define KERNBASE 0x80000000         // First kernel virtual address
 #define KERNLINK (KERNBASE+EXTMEM)  // Address where kernel is linked
 
+// mmap areas are placed between the heap and the stack guard page.
+#define MMAP_BASE   0x40000000                          // Lowest mmap address, the heap may not grow past this
+
+// User stack lives at a high address and grows down toward the heap on fault,
+// up to MAXSTACKSIZE (param.h). The page below that is never mapped so a runaway
+// stack faults there instead of running into the mmap areas or the heap.
+#define STACK_BASE  0x70000000                          // Top of the user stack
+#define STACK_LIMIT (STACK_BASE - MAXSTACKSIZE)         // Lowest address the stack may grow to
+#define STACK_GUARD (STACK_LIMIT - PGSIZE)              // Guard page, mmap areas stay below this
+
+// Between STACK_BASE and KERNBASE, the last two pages hold kernel data
+// that user space may read (see mm/vdata.h).
+
 #define V2P(a) (((uint32) (a)) - KERNBASE)
 #define P2V(a) ((void *)(((char *) (a)) + KERNBASE))
 
@@ -2,6 +2,7 @@
 // x86 memory management unit (MMU).
 
 // Eflags register
+#define FL_TF           0x00000100      // Trap Flag (single step)
 #define FL_IF           0x00000200      // Interrupt Enable
 
 // Control Register flags
@@ -10,6 +11,7 @@
 #define CR0_PG          0x80000000      // Paging
 
 #define CR4_PSE         0x00000010      // Page size extension
+#define CR4_PGE         0x00000080      // Page global enable
 
 // various segment selectors.
 #define SEG_KCODE 1  // kernel code
@@ -17,9 +19,17 @@
 #define SEG_UCODE 3  // user code
 #define SEG_UDATA 4  // user data+stack
 #define SEG_TSS   5  // this process's task state
+#define SEG_KCPU  6  // this cpu's counters, in %gs while in the kernel
 
 // cpu->gdt[NSEGS] holds the above segments.
-#define NSEGS     6
+#define NSEGS     7
+
+// SYSENTER loads %cs from MSR_SYSENTER_CS and %ss from the slot after it,
+// and SYSEXIT the user ones from the two slots after that, so the four
+// segments above must stay in this order.
+#define MSR_SYSENTER_CS  0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
 
 #ifndef __ASSEMBLER__
 // Segment Descriptor
@@ -83,18 +93,28 @@ struct segdesc {
 #define NPDENTRIES      1024    // # directory entries per page directory
 #define NPTENTRIES      1024    // # PTEs per page table
 #define PGSIZE          4096    // bytes mapped by a page
+#define LPGSIZE         0x400000 // bytes mapped by a large (PTE_PS) page
 
 #define PTXSHIFT        12      // offset of PTX in a linear address
 #define PDXSHIFT        22      // offset of PDX in a linear address
 
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
+#define LPGROUNDUP(sz)  (((sz)+LPGSIZE-1) & ~(LPGSIZE-1))
+#define LPGROUNDDOWN(a) (((a)) & ~(LPGSIZE-1))
 
 // Page table/directory entry flags.
 #define PTE_P           0x001   // Present
 #define PTE_W           0x002   // Writeable
 #define PTE_U           0x004   // User
+#define PTE_A           0x020   // Accessed
+#define PTE_D           0x040   // Dirty
 #define PTE_PS          0x080   // Page Size
+#define PTE_G           0x100   // Global, survives CR3 reloads when CR4_PGE is set
+#define PTE_SWAP        0x200   // Not present, page is on the swap disk in slot PTE_ADDR(pte) >> PTXSHIFT
+
+// Page fault error code bits
+#define FEC_WR          0x002   // Fault was caused by a write
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)   ((uint32)(pte) & ~0xFFF)
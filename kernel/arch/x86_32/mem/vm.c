@@ -5,15 +5,17 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "../../../lock/spinlock.h"
+#include "../../../lock/sleeplock.h"
 #include "../../../sched/proc.h"
+#include "../../../mm/vmspace.h"
 #include "../../../defs/elf.h"
+#include "../traps.h"
 #include "vm.h"
 
 
 extern char data[];  // defined by kernel.ld
 pmde_t *kpgdir;  // for use in scheduler()
 
-#define STACK_BASE 0x7000000
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
 void
@@ -30,26 +32,35 @@ seginit(void)
   c->gdt[SEG_KDATA] = SEG(STA_W, 0, 0xffffffff, 0);
   c->gdt[SEG_UCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, DPL_USER);
   c->gdt[SEG_UDATA] = SEG(STA_W, 0, 0xffffffff, DPL_USER);
+  c->gdt[SEG_KCPU] = SEG(STA_W, countbase(c - cpus), 0, 0);
   lgdt(c->gdt, sizeof(c->gdt));
+  loadgs(SEG_KCPU << 3);
 }
 
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page table pages.
-static pte_t *
+// A 4MB page has no page table, its directory entry is
+// returned instead.
+pte_t *
 walkpgdir(pmde_t *pgdir, const void *va, int alloc)
 {
   pmde_t *pde;
   pte_t *pgtab;
 
   pde = &pgdir[PDX(va)];
+  if(*pde & PTE_PS){
+    if(alloc)
+      panic("walkpgdir: large page");
+    return pde;
+  }
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if(!alloc || (pgtab = (pte_t*)kalloc_zeroed()) == 0)
+      return 0;
+    countpgtab(1);
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -61,7 +72,7 @@ walkpgdir(pmde_t *pgdir, const void *va, int alloc)
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
 // be page-aligned.
-static int
+int
 mappages(pmde_t *pgdir, void *va, uint32 size, uint32 pa, int perm)
 {
   char *a, *last;
@@ -83,44 +94,6 @@ mappages(pmde_t *pgdir, void *va, uint32 size, uint32 pa, int perm)
   return 0;
 }
 
-
-
-uint32 tally_page_directory(pmde_t *pgdir) {
-    uint32 total_pages = 0;
-
-    // Traverse page directory and count allocated pages
-    for (int i = 0; i < NPDENTRIES; i++) {
-        if (pgdir[i] & PTE_P) {
-            pte_t *pgtab = (pte_t*)P2V(PTE_ADDR(pgdir[i]));
-            for (int j = 0; j < NPTENTRIES; j++) {
-                if (pgtab[j] & PTE_U)
-                    total_pages++;
-            }
-        }
-    }
-
-    return total_pages;
-}
-
-
-uint32 tally_kernel_page_directory(void) {
-    uint32 total_pages = 0;
-    pmde_t *pgdir = kpgdir;
-
-
-    // Traverse page directory and count allocated pages
-    for (int i = 0; i < NPDENTRIES; i++) {
-        if (pgdir[i] & PTE_P) {
-            pte_t *pgtab = (pte_t*)P2V(PTE_ADDR(pgdir[i]));
-            for (int j = 0; j < NPTENTRIES; j++) {
-                if (pgtab[j] & PTE_P)
-                    total_pages++;
-            }
-        }
-    }
-
-    return total_pages;
-}
 // There is one page table per process, plus one that's used when
 // a CPU is not running any process (kpgdir). The kernel uses the
 // current process's page table during system calls and trap;
@@ -134,16 +107,27 @@ uint32 tally_kernel_page_directory(void) {
 //   KERNBASE..KERNBASE+EXTMEM: mapped to 0..EXTMEM (for I/O space)
 //   KERNBASE+EXTMEM..data: mapped to EXTMEM..V2P(data)
 //                for the kernel's instructions and r/o data
-//   data..KERNBASE+PHYSTOP: mapped to V2P(data)..PHYSTOP,
+//   data..KERNBASE+phystop: mapped to V2P(data)..phystop,
 //                                  rw data + free physical memory
 //   0xfe000000..0: mapped direct (devices such as ioapic)
 //
+// Wherever a kmap range covers a whole 4MB aligned chunk it is
+// mapped with one PTE_PS directory entry instead of a page table,
+// which keeps the kernel's TLB footprint small and saves setupkvm
+// from allocating a page table per 4MB of physical memory.
+//
+// The kernel mappings are the same in every page table and never
+// change, so they are marked PTE_G and stay in the TLB across CR3
+// reloads (CR4_PGE is turned on in entry.S).
+//
 // The kernel allocates physical memory for its heap and for user memory
-// between V2P(end) and the end of physical memory (PHYSTOP)
-// (directly addressable from end..P2V(PHYSTOP)).
+// between V2P(end) and the end of physical memory (phystop, see e820.c)
+// (directly addressable from end..P2V(phystop)).
 
 // This table defines the kernel's mappings, which are present in
 // every process's page table.
+#define KMAPMEM 2  // the entry that ends at phystop
+
 static struct kmap {
   void *virt;
   uint32 phys_start;
@@ -152,10 +136,38 @@ static struct kmap {
 } kmap[] = {
  { (void*)KERNBASE, 0,             EXTMEM,    PTE_W}, // I/O space
  { (void*)KERNLINK, V2P(KERNLINK), V2P(data), 0},     // kern text+rodata
- { (void*)data,     V2P(data),     PHYSTOP,   PTE_W}, // kern data+memory
+ { (void*)data,     V2P(data),     0,         PTE_W}, // kern data+memory, to phystop
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
+// Map [va, va+size) to pa for the kernel, with 4MB pages where
+// both addresses are 4MB aligned and 4KB pages elsewhere.
+static int
+mapkernel(pmde_t *pgdir, uint32 va, uint32 size, uint32 pa, int perm)
+{
+  uint32 n;
+
+  while(size > 0){
+    if(va % LPGSIZE == 0 && pa % LPGSIZE == 0 && size >= LPGSIZE){
+      if(pgdir[PDX(va)] & PTE_P)
+        panic("remap");
+      pgdir[PDX(va)] = pa | perm | PTE_P | PTE_PS;
+      n = LPGSIZE;
+    } else {
+      // up to the next 4MB boundary
+      n = LPGROUNDUP(va + 1) - va;
+      if(n > size || n == 0)
+        n = size;
+      if(mappages(pgdir, (void*)va, n, pa, perm) < 0)
+        return -1;
+    }
+    va += n;
+    pa += n;
+    size -= n;
+  }
+  return 0;
+}
+
 // Set up kernel part of a page table.
 pmde_t*
 setupkvm(void)
@@ -163,14 +175,14 @@ setupkvm(void)
   pmde_t *pgdir;
   struct kmap *k;
 
-  if((pgdir = (pmde_t*)kalloc()) == 0)
+  if((pgdir = (pmde_t*)kalloc_zeroed()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
-  if (P2V(PHYSTOP) > (void*)DEVSPACE)
-    panic("PHYSTOP too high");
+  countpgtab(1);
+  if (P2V(phystop) > (void*)DEVSPACE)
+    panic("phystop too high");
   for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint32)k->phys_start, k->perm) < 0) {
+    if(mapkernel(pgdir, (uint32)k->virt, k->phys_end - k->phys_start,
+                 (uint32)k->phys_start, k->perm | PTE_G) < 0) {
       freevm(pgdir);
       return 0;
     }
@@ -182,8 +194,9 @@ setupkvm(void)
 void
 kvmalloc(void)
 {
+  kmap[KMAPMEM].phys_end = phystop;
   kpgdir = setupkvm();
-  switchkvm();
+  lcr3(V2P(kpgdir));   // no cpus[] yet, so not switchkvm
 }
 
 // Switch h/w page table register to the kernel-only page table,
@@ -191,7 +204,29 @@ kvmalloc(void)
 void
 switchkvm(void)
 {
+  pushcli();
   lcr3(V2P(kpgdir));   // switch to the kernel page table
+  mycpu()->pgdir = kpgdir;
+  popcli();
+}
+
+// The scheduler doesn't switch back to kpgdir after a process
+// stops running (see switchuvm), so a CPU can still have a page
+// table loaded after its process moved on. Wait for every CPU
+// to let go of pgdir before it is freed. CPUs switch away as soon
+// as they run something else or go idle.
+static void
+pgdirunload(pmde_t *pgdir)
+{
+  struct cpu *c;
+
+  pushcli();
+  if(mycpu()->pgdir == pgdir)
+    switchkvm();
+  popcli();
+  for(c = cpus; c < cpus+ncpu; c++)
+    while(*(pmde_t* volatile*)&c->pgdir == pgdir)
+      ;
 }
 
 // Switch TSS and h/w page table to correspond to process p.
@@ -202,7 +237,7 @@ switchuvm(struct proc *p)
     panic("switchuvm: no process");
   if(p->kstack == 0)
     panic("switchuvm: no kstack");
-  if(p->pgdir == 0)
+  if(p->vm == 0 || p->vm->pgdir == 0)
     panic("switchuvm: no pgdir");
 
   pushcli();
@@ -215,7 +250,127 @@ switchuvm(struct proc *p)
   // forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (uint16) 0xFFFF;
   ltr(SEG_TSS << 3);
-  lcr3(V2P(p->pgdir));  // switch to process's address space
+  // Lazy TLB: if this CPU was the last to load p's page table and
+  // still has it loaded, the TLB is still good and the reload is skipped.
+  // p may have changed its mappings while running on another CPU,
+  // so that case always reloads. pgdir is set first so that tlbshootdown
+  // can't miss a CPU that is loading the page table.
+  if(mycpu()->pgdir != p->vm->pgdir || p->vm->tlbcpu != mycpu()){
+    mycpu()->pgdir = p->vm->pgdir;
+    __sync_synchronize();
+    lcr3(V2P(p->vm->pgdir));  // switch to process's address space
+  }
+  p->vm->tlbcpu = mycpu();
+  popcli();
+}
+
+// Flush this CPU's TLB for each CPU that asked (see tlbshootdown).
+// Called from the shootdown interrupt, and by CPUs waiting on one.
+void
+tlbserve(void)
+{
+  struct cpu *c = mycpu();
+  uint32 req;
+
+  if((req = c->tlbreq) == 0)
+    return;
+  lcr3(rcr3());
+  __sync_fetch_and_and(&c->tlbreq, ~req);
+}
+
+// Flush page table pgdir from the TLB of every CPU that has it loaded,
+// after the caller took mappings out of it, and wait until they have.
+// Each CPU that asks sets its own bit in the target's tlbreq. It waits
+// with interrupts off so it stays on this CPU, and answers requests
+// sent to it meanwhile, so two CPUs shooting at each other don't hang.
+static void
+tlbshootdown(pmde_t *pgdir)
+{
+  struct cpu *c, *me;
+  uint32 bit, sent;
+
+  pushcli();
+  me = mycpu();
+  bit = 1 << (me - cpus);
+  if(me->pgdir == pgdir)
+    lcr3(V2P(pgdir));
+  // the changed entries must be visible before we look at who has pgdir
+  __sync_synchronize();
+  sent = 0;
+  for(c = cpus; c < cpus+ncpu; c++){
+    if(c == me || c->pgdir != pgdir)
+      continue;
+    __sync_fetch_and_or(&c->tlbreq, bit);
+    lapicipi(c->apicid, T_TLBFLUSH);
+    sent |= 1 << (c - cpus);
+  }
+  for(c = cpus; c < cpus+ncpu; c++){
+    if(!(sent & (1 << (c - cpus))))
+      continue;
+    while(c->tlbreq & bit)
+      tlbserve();
+  }
+  popcli();
+}
+
+void
+tlbgatherinit(struct tlbgather *tg, struct vmspace *vm)
+{
+  tg->vm = vm;
+  tg->n = 0;
+}
+
+// Free the page at pa, which the caller just took out of a page table.
+// With tg, that waits for tlbgatherflush: until the TLBs are flushed,
+// threads on other CPUs may still be using the page. With no tg the
+// page table is not in use and the page goes at once.
+void
+tlbgather(struct tlbgather *tg, uint32 pa, int large)
+{
+  if(tg == 0){
+    if(large)
+      kfreelarge(P2V(pa));
+    else
+      kfree(P2V(pa));
+    return;
+  }
+  if(tg->n == NTLBGATHER)
+    tlbgatherflush(tg);
+  tg->pa[tg->n++] = pa | (large != 0);
+}
+
+// Flush the TLBs of tg's address space and free what was gathered.
+// Also flushes if nothing was, for mappings taken out that own no page.
+void
+tlbgatherflush(struct tlbgather *tg)
+{
+  int i;
+
+  tlbflush(tg->vm);
+  for(i = 0; i < tg->n; i++){
+    if(tg->pa[i] & 1)
+      kfreelarge(P2V(tg->pa[i] & ~1));
+    else
+      kfree(P2V(tg->pa[i]));
+  }
+  tg->n = 0;
+}
+
+// The current thread took mappings out of vm (or cleared bits the TLB
+// caches). An address space with one thread is only flushed here: vm's
+// tlbcpu becomes this CPU, so any other CPU still holding the page table
+// reloads it in switchuvm. Threads may be running on other CPUs, so then
+// every CPU with the page table loaded is flushed.
+void
+tlbflush(struct vmspace *vm)
+{
+  if(vm->ref > 1){
+    tlbshootdown(vm->pgdir);
+    return;
+  }
+  pushcli();
+  lcr3(V2P(vm->pgdir));
+  vm->tlbcpu = mycpu();
   popcli();
 }
 
@@ -228,8 +383,8 @@ inituvm(pmde_t *pgdir, char *init, uint32 sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
+  countuser(1);
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
@@ -260,50 +415,62 @@ loaduvm(pmde_t *pgdir, char *addr, struct inode *ip, uint32 offset, uint32 sz)
 
 // Allocate page tables and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
+// With grow_down set, oldsz is the current (page aligned) bottom of a region
+// that grows toward lower addresses, such as the user stack, and the pages
+// from PGROUNDDOWN(newsz) up to oldsz are mapped. Returns the new bottom.
 int
 allocuvm(pmde_t *pgdir, uint32 oldsz, uint32 newsz,int grow_down)
 {
   char *mem;
   uint32 a;
 
-  if(newsz >= KERNBASE)
-    return 0;
-  if(newsz < oldsz)
-    return oldsz;
   if(grow_down){
-      a = PGROUNDDOWN(oldsz - 1);
-      for(; a >= newsz; a -= PGSIZE){
-          mem = kalloc();
+      if(oldsz > KERNBASE)
+          return 0;
+      newsz = PGROUNDDOWN(newsz);
+      if(newsz >= oldsz)
+          return oldsz;
+      for(a = newsz; a < oldsz; a += PGSIZE){
+          mem = kalloc_zeroed();
+          if(mem == 0 && swapreclaim(1) > 0)
+              mem = kalloc_zeroed();
           if(mem == 0){
               cprintf("allocuvm out of memory\n");
-              deallocuvm(pgdir, oldsz, newsz);
+              deallocuvm(pgdir, a, newsz, 0);
               return 0;
           }
-          memset(mem, 0, PGSIZE);
           if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
               cprintf("allocuvm out of memory (2)\n");
-              deallocuvm(pgdir, oldsz, newsz);
+              deallocuvm(pgdir, a, newsz, 0);
               kfree(mem);
               return 0;
           }
-          if (a == 0) break; // To avoid underflow when 'a' is unsigned
+          countuser(1);
       }
+      return newsz;
   }
+
+  if(newsz >= KERNBASE)
+    return 0;
+  if(newsz < oldsz)
+    return oldsz;
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
+    if(mem == 0 && swapreclaim(1) > 0)
+      mem = kalloc_zeroed();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
-      deallocuvm(pgdir, newsz, oldsz);
+      deallocuvm(pgdir, newsz, oldsz, 0);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
-      deallocuvm(pgdir, newsz, oldsz);
+      deallocuvm(pgdir, newsz, oldsz, 0);
       kfree(mem);
       return 0;
     }
+    countuser(1);
   }
   return newsz;
 }
@@ -313,7 +480,7 @@ allocuvm(pmde_t *pgdir, uint32 oldsz, uint32 newsz,int grow_down)
 // need to be less than oldsz.  oldsz can be larger than the actual
 // process size.  Returns the new process size.
 int
-deallocuvm(pmde_t *pgdir, uint32 oldsz, uint32 newsz)
+deallocuvm(pmde_t *pgdir, uint32 oldsz, uint32 newsz, struct tlbgather *tg)
 {
   pte_t *pte;
   uint32 a, pa;
@@ -323,6 +490,16 @@ deallocuvm(pmde_t *pgdir, uint32 oldsz, uint32 newsz)
 
   a = PGROUNDUP(newsz);
   for(; a  < oldsz; a += PGSIZE){
+    if(pgdir[PDX(a)] & PTE_PS){
+      if(a % LPGSIZE != 0 || a + LPGSIZE > oldsz)
+        panic("deallocuvm: part of a large page");
+      pa = PTE_ADDR(pgdir[PDX(a)]);
+      pgdir[PDX(a)] = 0;
+      tlbgather(tg, pa, 1);
+      countuser(-(LPGSIZE / PGSIZE));
+      a += LPGSIZE - PGSIZE;
+      continue;
+    }
     pte = walkpgdir(pgdir, (char*)a, 0);
     if(!pte)
       a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
@@ -330,8 +507,11 @@ deallocuvm(pmde_t *pgdir, uint32 oldsz, uint32 newsz)
       pa = PTE_ADDR(*pte);
       if(pa == 0)
         panic("kfree");
-      char *v = P2V(pa);
-      kfree(v);
+      *pte = 0;
+      tlbgather(tg, pa, 0);
+      countuser(-1);
+    } else if(*pte & PTE_SWAP){
+      swapfree(*pte);
       *pte = 0;
     }
   }
@@ -347,14 +527,19 @@ freevm(pmde_t *pgdir)
 
   if(pgdir == 0)
     panic("freevm: no pgdir");
-  deallocuvm(pgdir, KERNBASE, 0);
+  pgdirunload(pgdir);
+  vdataunmap(pgdir);
+  deallocuvm(pgdir, KERNBASE, 0, 0);
   for(i = 0; i < NPDENTRIES; i++){
-    if(pgdir[i] & PTE_P){
+    // 4MB kernel pages have no page table to free
+    if((pgdir[i] & PTE_P) && !(pgdir[i] & PTE_PS)){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
+      countpgtab(-1);
     }
   }
   kfree((char*)pgdir);
+  countpgtab(-1);
 }
 
 // Clear PTE_U on a page. Used to create an inaccessible
@@ -370,33 +555,54 @@ clearpteu(pmde_t *pgdir, char *uva)
   *pte &= ~PTE_U;
 }
 
-// Given a parent process's page table, create a copy
-// of it for a child.
-pmde_t*
-copyuvm(pmde_t *pgdir, uint32 sz)
+// Copy the user pages in [start, end) of pgdir into d.
+static int
+copyrange(pmde_t *d, pmde_t *pgdir, uint32 start, uint32 end)
 {
-  pmde_t *d;
   pte_t *pte;
   uint32 pa, i, flags;
   char *mem;
 
-  if((d = setupkvm()) == 0)
-    return 0;
-  for(i = 0; i < sz; i += PGSIZE){
+  for(i = start; i < end; i += PGSIZE){
+    // allocate first, making room may page out the very page we copy
+    if((mem = kalloc()) == 0 && (swapreclaim(1) == 0 || (mem = kalloc()) == 0))
+      return -1;
     if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
       panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
-    pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
+    if(*pte & PTE_SWAP){
+      // the child gets its copy in memory
+      swapcopy(*pte, mem);
+      flags = (flags & ~PTE_SWAP) | PTE_P;
+    } else {
+      if(!(*pte & PTE_P))
+        panic("copyuvm: page not present");
+      pa = PTE_ADDR(*pte);
+      memmove(mem, (char*)P2V(pa), PGSIZE);
+    }
     if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
       kfree(mem);
-      goto bad;
+      return -1;
     }
+    countuser(1);
   }
+  return 0;
+}
+
+// Given a parent process's page table, create a copy
+// of it for a child. Copies the image [0, sz) and the
+// stack [stack_base, STACK_BASE).
+pmde_t*
+copyuvm(pmde_t *pgdir, uint32 sz, uint32 stack_base)
+{
+  pmde_t *d;
+
+  if((d = setupkvm()) == 0)
+    return 0;
+  if(copyrange(d, pgdir, 0, sz) < 0)
+    goto bad;
+  if(copyrange(d, pgdir, stack_base, STACK_BASE) < 0)
+    goto bad;
   return d;
 
 bad:
@@ -412,6 +618,8 @@ uva2ka(pmde_t *pgdir, char *uva)
   pte_t *pte;
 
   pte = walkpgdir(pgdir, uva, 0);
+  if(pte == 0)
+    return 0;
   if((*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
@@ -4,6 +4,21 @@
 
 #ifndef XV6_ORIGINAL_VM_H
 #define XV6_ORIGINAL_VM_H
-uint32 tally_page_directory(pmde_t *pgdir);
-uint32 tally_kernel_page_directory(void);
+pte_t *walkpgdir(pmde_t *pgdir, const void *va, int alloc);
+int mappages(pmde_t *pgdir, void *va, uint32 size, uint32 pa, int perm);
+extern pmde_t *kpgdir;
+
+struct vmspace;
+
+// Pages taken out of an address space whose TLB entries may still be
+// live on other CPUs. They are freed only after tlbflush, see tlbgather.
+#define NTLBGATHER 32
+struct tlbgather {
+  struct vmspace *vm;
+  int n;
+  uint32 pa[NTLBGATHER];  // low bit set for a 4MB page
+};
+void tlbgatherinit(struct tlbgather *tg, struct vmspace *vm);
+void tlbgather(struct tlbgather *tg, uint32 pa, int large);
+void tlbgatherflush(struct tlbgather *tg);
 #endif //XV6_ORIGINAL_VM_H
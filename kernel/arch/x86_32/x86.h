@@ -108,6 +108,12 @@ static inline void sti(void)
     asm volatile("sti");
 }
 
+// Tells the CPU it is in a spin-wait loop.
+static inline void pause(void)
+{
+    asm volatile("pause");
+}
+
 // Atomic exchange of a value.
 static inline uint32 xchg(volatile uint32 *addr, uint32 newval)
 {
@@ -133,6 +139,36 @@ static inline void lcr3(uint32 val)
     asm volatile("movl %0,%%cr3" : : "r" (val));
 }
 
+static inline uint32 rcr3(void)
+{
+    uint32 val;
+    asm volatile("movl %%cr3,%0" : "=r" (val));
+    return val;
+}
+
+// Runs CPUID leaf op, returning the four result registers.
+static inline void readcpuid(uint32 op, uint32 *eax, uint32 *ebx, uint32 *ecx, uint32 *edx)
+{
+    asm volatile("cpuid" : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx) : "a" (op), "c" (0));
+}
+
+// Reads the time stamp counter.
+static inline uint64 rdtsc(void)
+{
+    uint32 lo, hi;
+    asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64) hi << 32) | lo;
+}
+
+#define CPUID_EDX_SEP   (1 << 11)  // leaf 1, sysenter and sysexit
+#define CPUID_EDX_SSE2  (1 << 26)  // leaf 1, movnti and friends
+
+// Writes a model specific register.
+static inline void wrmsr(uint32 msr, uint64 val)
+{
+    asm volatile("wrmsr" : : "c" (msr), "a" ((uint32) val), "d" ((uint32) (val >> 32)));
+}
+
 //PAGEBREAK: 36
 // Layout of the trap frame built on the stack by the
 // hardware and by trapasm.S, and passed to trap().
@@ -0,0 +1,45 @@
+// Per-CPU event counters.
+//
+// Every CPU has its own row of counters, on cache lines of its own, and
+// the %gs segment of the kernel points at it. countinc in counters.h
+// adds to it with one instruction. Readers add up the rows, which may
+// be a few counts behind on other CPUs.
+
+#include "../../user/types.h"
+#include "../defs/defs.h"
+#include "../defs/param.h"
+#include "counters.h"
+
+static struct {
+  uint32 n[NCOUNTER];
+} __attribute__((aligned(64))) counts[NCPU];
+
+// Where seginit bases CPU cpu's %gs.
+uint32
+countbase(int cpu)
+{
+  return (uint32)&counts[cpu];
+}
+
+// The total of counter id over all CPUs.
+uint32
+countsum(int id)
+{
+  uint32 sum = 0;
+  int i;
+
+  for(i = 0; i < NCPU; i++)
+    sum += counts[i].n[id];
+  return sum;
+}
+
+// Fill in up to n totals and return NCOUNTER.
+int
+countread(uint32 *v, int n)
+{
+  int id;
+
+  for(id = 0; id < NCOUNTER && id < n; id++)
+    v[id] = countsum(id);
+  return NCOUNTER;
+}
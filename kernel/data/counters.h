@@ -0,0 +1,28 @@
+// Per-CPU event counters, see counters.c.
+// The counters system call fills in an array indexed by these ids.
+// A new counter gets the next id, a name in COUNTERNAMES and a bigger
+// NCOUNTER, all here.
+
+#define CNT_TICK        0   // timer interrupts, on every CPU
+#define CNT_SYSCALL     1   // system calls
+#define CNT_SWITCH      2   // switches from a scheduler to a process
+#define CNT_PGFAULT     3   // user page faults
+#define CNT_EXIT        4   // processes that exited
+#define CNT_EXITTIME    5   // scheduler loops those processes ran for
+#define CNT_BHIT        6   // bread found the block cached
+#define CNT_BMISS       7   // bread had to recycle a buffer
+#define CNT_KALLOC      8   // pages allocated
+#define CNT_KFREE       9   // pages freed
+#define NCOUNTER        10
+
+#define COUNTERNAMES { \
+  "tick", "syscall", "switch", "pgfault", "exit", "exittime", \
+  "bhit", "bmiss", "kalloc", "kfree", \
+}
+
+// Count on this CPU. %gs points at this CPU's counters (see seginit),
+// and a single instruction can't be split by an interrupt or a move to
+// another CPU, so no lock or atomic is needed.
+#define countadd(id, n) \
+  asm volatile("addl %1, %%gs:%c0" : : "i" (4*(id)), "ri" ((uint32)(n)))
+#define countinc(id)  countadd(id, 1)
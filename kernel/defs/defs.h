@@ -1,9 +1,17 @@
 struct buf;
 struct context;
 struct file;
+struct files;
 struct inode;
 struct pipe;
+struct memstat;
+struct lockstatent;
 struct proc;
+struct rcuhead;
+struct semaphore;
+struct shm;
+struct vmspace;
+struct tlbgather;
 struct rtcdate;
 struct spinlock;
 struct sleeplock;
@@ -15,6 +23,7 @@ struct nonblockinglock;
 // bio.c
 void            binit(void);
 struct buf*     bread(uint32, uint32);
+struct buf*     breadshared(uint32, uint32);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
 struct buf*   breada(uint32,uint32,uint32);
@@ -25,6 +34,11 @@ void            cprintf(char*, ...);
 void            consoleintr(int(*)(void));
 void            panic(char*) __attribute__((noreturn));
 void            change_mode(int);
+// counters.c
+uint32          countbase(int);
+uint32          countsum(int);
+int             countread(uint32*, int);
+
 // exec.c
 int             exec(char*, char**);
 
@@ -32,10 +46,17 @@ int             exec(char*, char**);
 struct file*    filealloc(void);
 void            fileclose(struct file*);
 struct file*    filedup(struct file*);
+struct file*    fileget(int);
+void            fileunhold(struct proc*);
 void            fileinit(void);
+struct files*   filesalloc(void);
+struct files*   filescopy(struct files*);
+struct files*   filesdup(struct files*);
+void            filesput(struct files*);
 int             fileread(struct file*, char*, int n);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
+int             filesend(struct file*, struct file*, uint32*, int);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
@@ -45,6 +66,7 @@ struct inode*   ialloc(uint32, short);
 struct inode*   idup(struct inode*);
 void            iinit(int dev,int sbnum);
 void            ilock(struct inode*);
+void            ilockshared(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
@@ -57,6 +79,12 @@ void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint32, uint32);
 int             iputmount(struct inode *ip);
 
+// e820.c
+extern uint32   phystop;
+void            e820init(void);
+int             e820usable(uint32, uint32);
+void            e820free(uint32, uint32, void (*)(void*, void*));
+
 // ide.c
 void            ideinit(void);
 void            secondaryideinit(void);
@@ -71,9 +99,18 @@ void            ioapicinit(void);
 
 // kalloc.c
 char*           kalloc(void);
+char*           kalloc_zeroed(void);
+void            countpgtab(int);
+void            countuser(int);
+int             freemem(void);
+int             kmemlow(void);
+void            kmemstat(struct memstat*);
+void            kzeroidle(void);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+char*           kalloclarge(void);
+void            kfreelarge(char*);
 
 // kbd.c
 void            kbdintr(void);
@@ -85,6 +122,7 @@ extern volatile uint32*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
 void            lapicstartap(uint8, uint32);
+void            lapicipi(uint8, int);
 void            microdelay(int);
 
 // log.c
@@ -97,6 +135,19 @@ void            end_op();
 int             mount(uint32 dev, char *path);
 int             unmount(char *mountpoint);
 
+// mmap.c
+int             mmap(uint32, uint32, int, int, struct file*, uint32);
+int             munmap(uint32, uint32);
+int             msync(uint32, uint32);
+int             mmapfault(uint32, int);
+int             mmapvalid(struct vmspace*, uint32, uint32, int);
+uint32          mmapend(struct vmspace*, uint32);
+int             mmapfork(struct vmspace*, struct vmspace*);
+int             mmapswappable(struct vmspace*, uint32);
+void            munmapall(struct vmspace*);
+int             shmmap(struct shm*);
+int             shmunmap(uint32);
+
 // mp.c
 extern int      ismp;
 void            mpinit(void);
@@ -110,15 +161,31 @@ int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
+int             pipesplicein(struct pipe*, struct inode*, uint32*, int);
+int             pipespliceout(struct pipe*, struct file*, int);
+int             pipesplice(struct pipe*, struct pipe*, int);
+int             pipegift(struct pipe*, char*, int);
+
+// shm.c
+void            shminit(void);
+struct shm*     shmalloc(char*, uint32);
+struct shm*     shmlookup(char*);
+void            shmdup(struct shm*);
+void            shmput(struct shm*);
 
 //PAGEBREAK: 16
 // proc.c
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
-int             freemem(void);
+int             clone(void (*)(void*), void*, void*);
+int             join(void**);
 int             growproc(int);
+int             growstack(uint32);
 int             kill(int);
+struct proc*    pidlookup(int);
+int             kproc(char*, void (*)(void));
+int             procrss(int);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
@@ -135,21 +202,74 @@ int             sig(int,int);
 void            sighandler(void (*)(int));
 void            sigignore(int,int);
 
+// vmspace.c
+void            vmspaceinit(void);
+struct vmspace* vmspacealloc(pmde_t*);
+struct vmspace* vmspacedup(struct vmspace*);
+void            vmspaceput(struct vmspace*);
+int             vmpin(struct vmspace*, uint32, uint32);
+void            vmunpin(struct proc*);
+int             vmunmapstart(struct vmspace*, uint32, uint32);
+void            vmunmapdone(struct vmspace*);
+
+// swap.c
+void            swapinit(void);
+int             swapreclaim(int);
+int             swapin(struct vmspace*, uint32, int);
+int             swapinrange(struct vmspace*, uint32, uint32);
+void            swapcopy(uint32, char*);
+void            swapfree(uint32);
+int             swapcount(pmde_t*, uint32, uint32);
+void            swapstat(struct memstat*);
+
 // swtch.S
 void            swtch(struct context**, struct context*);
 
+// futex.c
+void            futexinit(void);
+int             futexwait(uint32*, int);
+int             futexwake(uint32*, int);
+
+// lockstat.c
+int             lockstatid(char*, int);
+void            lockstatacquire(int, int, uint64);
+void            lockstatrelease(int, int, uint64);
+void            lockstatspin(int, int, int);
+int             lockstatread(struct lockstatent*, int);
+void            lockstatreset(void);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint32*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            initmcslock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
 
+// rcu.c
+void            rcuinit(void);
+void            call_rcu(struct rcuhead*, void (*)(struct rcuhead*));
+void            rcuquiesce(int);
+void            synchronize_rcu(void);
+
+// semaphore.c
+void            seminit(void);
+void            initsem(struct semaphore*, int);
+int             semwait(struct semaphore*);
+int             semtrywait(struct semaphore*);
+void            sempost(struct semaphore*);
+struct semaphore* semopen(char*, int);
+void            semclose(struct semaphore*);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
+int             acquiresleepkillable(struct sleeplock*);
+void            acquiresleepshared(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
+void            releasesleepshared(struct sleeplock*);
+void            downgradesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 void            initnonblockinglock(struct nonblockinglock *lk, char *name);
@@ -170,9 +290,11 @@ char*           strncpy(char*, const char*, int);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
-int             argstr(int, char**);
+int             argptrw(int, char**, int);
+int             argstr(int, char*, int);
 int             fetchint(uint32, int*);
-int             fetchstr(uint32, char**);
+int             fetchstr(uint32, char*, int);
+int             fetchptr(uint32, char**, int, int);
 void            syscall(void);
 
 // timer.c
@@ -180,6 +302,7 @@ void            timerinit(void);
 
 // trap.c
 void            idtinit(void);
+void            sysenterinit(void);
 extern uint32     ticks;
 void            tvinit(void);
 extern struct spinlock tickslock;
@@ -189,18 +312,27 @@ void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
 
+// vdata.c
+void            vdatainit(void);
+void            vdatatick(uint32);
+int             vdatamap(pmde_t*, int);
+void            vdataunmap(pmde_t*);
+void            vdatathreaded(pmde_t*);
+
 // vm.c
 void            seginit(void);
 void            kvmalloc(void);
 pmde_t*          setupkvm(void);
 char*           uva2ka(pmde_t*, char*);
 int             allocuvm(pmde_t*, uint32, uint32,int);
-int             deallocuvm(pmde_t*, uint32, uint32);
+int             deallocuvm(pmde_t*, uint32, uint32, struct tlbgather*);
 void            freevm(pmde_t*);
 void            inituvm(pmde_t*, char*, uint32);
 int             loaduvm(pmde_t*, char*, struct inode*, uint32, uint32);
-pmde_t*          copyuvm(pmde_t*, uint32);
+pmde_t*          copyuvm(pmde_t*, uint32, uint32);
 void            switchuvm(struct proc*);
+void            tlbflush(struct vmspace*);
+void            tlbserve(void);
 void            switchkvm(void);
 int             copyout(pmde_t*, uint32, void*, uint32);
 void            clearpteu(pmde_t *pgdir, char *uva);
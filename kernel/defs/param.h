@@ -8,9 +8,23 @@
 #define ROOTDEV       1  // device number of file system root disk
 #define SECONDARYDEV  2 //our dev for our second filesystem which will be able to be mounted
 #define MAXARG       32  // max exec arguments
+#define MAXPATH     128  // max path name length, system calls copy it in
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define NBUF         (MAXOPBLOCKS*3)  // min size of disk block cache, binit scales it to memory
+#define NBUFMAX      512  // max size of disk block cache
+#define FSSIZE       2000  // size of file system in blocks
 #define MAXSTACKSIZE (1024 * 1024 * 2) // max stack size 2mb
+#define NVMA         16  // mmap areas per process
+#define NSHM         16  // shared memory segments per system
+#define NSEM         32  // named semaphores per system
+#define PIPEPAGES    16  // pages in a pipe's ring buffer, a power of two
+#define SHMMAXPAGES  64  // max pages in a shared memory segment
+#define NLPAGE        4  // 4MB pages set aside for MAP_HUGE mappings
+#define NZEROPAGE   256  // min free pages the idle loop keeps zeroed, kinit2 scales it to memory
+#define SWAPDEV       3  // swap disk, ata1 slave, used only if ideinit finds it
+#define NSWAPSLOT  4096  // pages the swap disk holds
+#define SWAPSIZE     (NSWAPSLOT*8)  // size of the swap disk in blocks, 8 per page
+#define SWAPLOW     256  // kswapd starts paging out below this many free pages
+#define SWAPHIGH    512  // ... and stops once this many are free again
 
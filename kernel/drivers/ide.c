@@ -29,7 +29,7 @@
 #define DISK1 0x1  // ata0 master (xv6.img)
 #define DISK2 0x2  // ata0 slave (secondaryfs.img)
 #define DISK3 0x4  // ata1 master (secondaryfs.img)
-#define DISK4 0x8  // ata1 slave (unimplemented)
+#define DISK4 0x8  // ata1 slave, the swap disk (SWAPDEV)
 #define DISK5 0x10 // ata2 master (unimplemented)
 #define DISK6 0x20 // ata2 slave (unimplemented)
 #define DISK7 0x40 // ata3 master (unimplemented)
@@ -52,7 +52,6 @@
 
 static struct spinlock idelock;
 static struct spinlock idelock2;
-static struct spinlock idelock3;
 static struct spinlock idelock4;
 static struct spinlock idelock5;
 static struct spinlock idelock6;
@@ -61,7 +60,6 @@ static struct spinlock idelock8;
 
 static struct buf *idequeue;
 static struct buf *idequeue2;
-static struct buf *idequeue3;
 static struct buf *idequeue4;
 static struct buf *idequeue5;
 static struct buf *idequeue6;
@@ -84,7 +82,7 @@ char disk_query() {
 // Wait for IDE disk to become ready.
 static int idewait(int dev, int checkerr) {
     int r;
-    int port = (dev == 2) ? BASEPORT2 + 7 : BASEPORT1 + 7;
+    int port = (dev == 2 || dev == 3) ? BASEPORT2 + 7 : BASEPORT1 + 7;
 
     /*
      * I have to send the ident cmd to the secondary ata controller for some reason, I did not have to do this
@@ -138,6 +136,7 @@ void
 ideinit(void) {
     int i;
     initlock(&idelock, "ide");
+    initlock(&idelock2, "ide2");
     disk_presence = 0;
     ioapicenable(IRQ_IDE, ncpu - 1);
     ioapicenable(IRQ_IDE2, ncpu - 1);
@@ -248,7 +247,7 @@ static void
 idestart(uint32 dev, struct buf *b) {
     if (b == 0)
         panic("idestart");
-    if (b->blockno >= FSSIZE)
+    if (b->blockno >= (b->dev == SWAPDEV ? SWAPSIZE : FSSIZE))
         panic("incorrect blockno");
     int sector_per_block = BSIZE / SECTOR_SIZE;
     int sector = b->blockno * sector_per_block;
@@ -405,7 +404,7 @@ ideintr2(void) {
     // First queued buffer is the active request.
     acquire(&idelock2);
     if ((b = idequeue2) == 0) {
-        release(&idelock);
+        release(&idelock2);
         return;
     }
     idequeue2 = b->qnext;
@@ -418,10 +417,9 @@ ideintr2(void) {
     b->flags |= B_VALID;
     b->flags &= ~B_DIRTY;
     wakeup(b);
-    if ((b = idequeue2) != 0) {
+    // Start the next one, it stays at the head of the queue until it is done.
+    if ((b = idequeue2) != 0)
         idestart(b->dev, idequeue2);
-        idequeue2 = b->qnext;
-    }
     release(&idelock2);
 }
 
@@ -456,7 +454,9 @@ iderw(struct buf *b, uint32 dev) {
             release(&idelock);
             return;
 
+        // Both drives on the secondary channel share its queue and interrupt.
         case 2:
+        case 3:
             acquire(&idelock2);  //DOC:acquire-lock
             // Append b to idequeue.
             b->qnext = 0;
@@ -473,23 +473,6 @@ iderw(struct buf *b, uint32 dev) {
             release(&idelock2);
             return;
 
-        case 3:
-            acquire(&idelock3);  //DOC:acquire-lock
-            // Append b to idequeue.
-            b->qnext = 0;
-            for (pp = &idequeue3; *pp; pp = &(*pp)->qnext)  //DOC:insert-queue
-                ;
-            *pp = b;
-            // Start disk if necessary.
-            if (idequeue3 == b)
-                idestart(b->dev, b);
-            // Wait for request to finish.
-            while ((b->flags & (B_VALID | B_DIRTY)) != B_VALID) {
-                sleep(b, &idelock3);
-            }
-            release(&idelock3);
-            return;
-
         case 4:
             acquire(&idelock4);  //DOC:acquire-lock
             // Append b to idequeue.
@@ -3,23 +3,24 @@
 #include "arch/x86_32/mem/memlayout.h"
 #include "arch/x86_32/mem/mmu.h"
 #include "lock/spinlock.h"
+#include "lock/sleeplock.h"
 #include "sched/proc.h"
+#include "mm/vmspace.h"
 #include "defs/defs.h"
 #include "arch/x86_32/x86.h"
 #include "defs/elf.h"
 
-//Keep stack at a high address so it will grow down toward the heap, this will allow for a dynamically growing stack
-#define STACK_BASE 0x70000000
 int
 exec(char *path, char **argv)
 {
     char *s, *last;
     int i, off;
-    uint32 argc, sz, sp, ustack[3+MAXARG+1];
+    uint32 argc, sz, sp, stack_base, ustack[3+MAXARG+1];
     struct elfhdr elf;
     struct inode *ip;
     struct proghdr ph;
-    pmde_t *pgdir, *oldpgdir;
+    pmde_t *pgdir;
+    struct vmspace *vm, *oldvm;
     struct proc *curproc = myproc();
 
     begin_op();
@@ -63,13 +64,18 @@ exec(char *path, char **argv)
     end_op();
     ip = 0;
 
-    // Allocate two pages at the next page boundary.
-    // Make the first inaccessible.  Use the second as the user stack.
+    // The image must stay below the mmap areas and the stack.
     sz = PGROUNDUP(sz);
-    if((sz = allocuvm(pgdir, sz, sz + 2*PGSIZE,0)) == 0)
+    if(sz > MMAP_BASE)
+        goto bad;
+
+    // Start with a single stack page just below STACK_BASE, the page
+    // fault handler grows it on demand (see growstack in proc.c).
+    if((stack_base = allocuvm(pgdir, STACK_BASE, STACK_BASE - PGSIZE, 1)) == 0)
+        goto bad;
+    sp = STACK_BASE;
+    if(vdatamap(pgdir, curproc->pid) < 0)
         goto bad;
-    clearpteu(pgdir, (char*)(sz - 2*PGSIZE));
-    sp = sz;
 
     // Push argument strings, prepare rest of stack in ustack.
     for(argc = 0; argv[argc]; argc++) {
@@ -95,16 +101,23 @@ exec(char *path, char **argv)
     for(last=s=path; *s; s++)
         if(*s == '/')
             last = s+1;
+    if((vm = vmspacealloc(pgdir)) == 0)
+        goto bad;
     safestrcpy(curproc->name, last, sizeof(curproc->name));
 
-    // Commit to the user image.
-    oldpgdir = curproc->pgdir;
-    curproc->pgdir = pgdir;
-    curproc->sz = sz;
+    // Commit to the user image. Mappings of the old image are
+    // written back and dropped with it, unless other threads
+    // still use it: they go on running the old program.
+    vm->sz = sz;
+    vm->stack_base = stack_base;
+    vm->rss = IMAGEPAGES(vm);
+    oldvm = curproc->vm;
+    curproc->vm = vm;
     curproc->tf->eip = elf.entry;  // main
     curproc->tf->esp = sp;
     switchuvm(curproc);
-    freevm(oldpgdir);
+    vmunpin(curproc);
+    vmspaceput(oldvm);
 
     return 0;
 
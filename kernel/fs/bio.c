@@ -12,6 +12,8 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+// * Code that only reads a block can use breadshared instead,
+//     which lets other readers use the buffer at the same time.
 //
 // The implementation uses two state flags internally:
 // * B_VALID: the buffer data has been read from the disk.
@@ -23,32 +25,46 @@
 #include "../defs/param.h"
 #include "../lock/spinlock.h"
 #include "../lock/sleeplock.h"
+#include "../arch/x86_32/mem/mmu.h"
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "../data/counters.h"
 
 #define MAX_READA 4
 struct {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  int nbuf;
 
   // Linked list of all buffers, through prev/next.
   // head.next is most recently used.
   struct buf head;
 } bcache;
 
+// One buffer per 256 pages of memory, between NBUF and NBUFMAX,
+// allocated from the pages kinit1 freed.
 void
 binit(void)
 {
   struct buf *b;
+  char *page = 0;
+  int i, perpage = PGSIZE / sizeof(struct buf);
 
-  initlock(&bcache.lock, "bcache");
+  initmcslock(&bcache.lock, "bcache");
+  bcache.nbuf = phystop / PGSIZE / 256;
+  if(bcache.nbuf < NBUF)
+    bcache.nbuf = NBUF;
+  if(bcache.nbuf > NBUFMAX)
+    bcache.nbuf = NBUFMAX;
 
 //PAGEBREAK!
   // Create linked list of buffers
   bcache.head.prev = &bcache.head;
   bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
+  for(i = 0; i < bcache.nbuf; i++){
+    if(i % perpage == 0 && (page = kalloc_zeroed()) == 0)
+      panic("binit");
+    b = (struct buf*)page + i % perpage;
     b->next = bcache.head.next;
     b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
@@ -59,9 +75,9 @@ binit(void)
 
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
-// In either case, return locked buffer.
+// In either case, return locked buffer, locked shared if asked.
 static struct buf*
-bget(uint32 dev, uint32 blockno)
+bget(uint32 dev, uint32 blockno, int shared)
 {
   struct buf *b;
 
@@ -72,7 +88,11 @@ bget(uint32 dev, uint32 blockno)
     if(b->dev == dev && b->blockno == blockno){
       b->refcnt++;
       release(&bcache.lock);
-      acquiresleep(&b->lock);
+      countinc(CNT_BHIT);
+      if(shared)
+        acquiresleepshared(&b->lock);
+      else
+        acquiresleep(&b->lock);
       return b;
     }
   }
@@ -87,7 +107,11 @@ bget(uint32 dev, uint32 blockno)
       b->flags = 0;
       b->refcnt = 1;
       release(&bcache.lock);
-      acquiresleep(&b->lock);
+      countinc(CNT_BMISS);
+      if(shared)
+        acquiresleepshared(&b->lock);
+      else
+        acquiresleep(&b->lock);
       return b;
     }
   }
@@ -100,13 +124,32 @@ bread(uint32 dev, uint32 blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
   if((b->flags & B_VALID) == 0) {
     iderw(b,dev);
   }
   return b;
 }
 
+// Like bread, but the buffer is locked shared and must not be changed.
+// Release it with brelse as usual.
+struct buf*
+breadshared(uint32 dev, uint32 blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno, 1);
+  if((b->flags & B_VALID) == 0) {
+    // reading it in takes the lock exclusive
+    releasesleepshared(&b->lock);
+    acquiresleep(&b->lock);
+    if((b->flags & B_VALID) == 0)
+      iderw(b,dev);
+    downgradesleep(&b->lock);
+  }
+  return b;
+}
+
 struct buf*
 breada(uint32 dev, uint32 blockno,uint32 reada_len){
 
@@ -116,7 +159,7 @@ breada(uint32 dev, uint32 blockno,uint32 reada_len){
     struct buf *b[MAX_READA];
     for(int i=0;i<reada_len;i++){
 
-        b[i] = bget(dev, blockno + i);
+        b[i] = bget(dev, blockno + i, 0);
 
         if(b[i] == NULL){
 
@@ -144,15 +187,15 @@ bwrite(struct buf *b)
   iderw(b,b->dev);
 }
 
-// Release a locked buffer.
+// Release a locked buffer, exclusive or shared.
 // Move to the head of the MRU list.
 void
 brelse(struct buf *b)
 {
-  if(!holdingsleep(&b->lock))
-    panic("brelse");
-
-  releasesleep(&b->lock);
+  if(holdingsleep(&b->lock))
+    releasesleep(&b->lock);
+  else
+    releasesleepshared(&b->lock);
 
   acquire(&bcache.lock);
   b->refcnt--;
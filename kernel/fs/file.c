@@ -5,9 +5,12 @@
 #include "../../user/types.h"
 #include "../defs/defs.h"
 #include "../defs/param.h"
+#include "../../user/stat.h"
+#include "../arch/x86_32/mem/mmu.h"
 #include "fs.h"
 #include "../lock/spinlock.h"
 #include "../lock/sleeplock.h"
+#include "../sched/proc.h"
 #include "file.h"
 
 struct devsw devsw[NDEV];
@@ -16,10 +19,102 @@ struct {
   struct file file[NFILE];
 } ftable;
 
+// Descriptor tables, one per process or shared by a group of threads.
+struct {
+  struct spinlock lock;
+  struct files files[NPROC];
+} fdtable;
+
 void
 fileinit(void)
 {
+  struct files *fs;
+
   initlock(&ftable.lock, "ftable");
+  initlock(&fdtable.lock, "fdtable");
+  for(fs = fdtable.files; fs < fdtable.files + NPROC; fs++)
+    initlock(&fs->lock, "files");
+}
+
+// Allocate an empty descriptor table with one reference.
+struct files*
+filesalloc(void)
+{
+  struct files *fs;
+
+  acquire(&fdtable.lock);
+  for(fs = fdtable.files; fs < fdtable.files + NPROC; fs++){
+    if(fs->ref == 0){
+      fs->ref = 1;
+      release(&fdtable.lock);
+      memset(fs->ofile, 0, sizeof(fs->ofile));
+      fs->cwd = 0;
+      return fs;
+    }
+  }
+  release(&fdtable.lock);
+  return 0;
+}
+
+// Share descriptor table fs with another thread.
+struct files*
+filesdup(struct files *fs)
+{
+  acquire(&fdtable.lock);
+  fs->ref++;
+  release(&fdtable.lock);
+  return fs;
+}
+
+// A new descriptor table holding the same open files as fs, for fork.
+struct files*
+filescopy(struct files *fs)
+{
+  struct files *nfs;
+  int fd;
+
+  if((nfs = filesalloc()) == 0)
+    return 0;
+  acquire(&fs->lock);
+  for(fd = 0; fd < NOFILE; fd++)
+    if(fs->ofile[fd])
+      nfs->ofile[fd] = filedup(fs->ofile[fd]);
+  release(&fs->lock);
+  nfs->cwd = idup(fs->cwd);
+  return nfs;
+}
+
+// Drop a reference to descriptor table fs. The last one
+// closes the open files and lets go of the current directory.
+void
+filesput(struct files *fs)
+{
+  int fd;
+
+  acquire(&fdtable.lock);
+  if(fs->ref < 1)
+    panic("filesput");
+  if(--fs->ref > 0){
+    release(&fdtable.lock);
+    return;
+  }
+  fs->ref = 1;  // nobody else has it, but keep the slot until we are done
+  release(&fdtable.lock);
+
+  for(fd = 0; fd < NOFILE; fd++){
+    if(fs->ofile[fd]){
+      fileclose(fs->ofile[fd]);
+      fs->ofile[fd] = 0;
+    }
+  }
+  begin_op();
+  iput(fs->cwd);
+  end_op();
+  fs->cwd = 0;
+
+  acquire(&fdtable.lock);
+  fs->ref = 0;
+  release(&fdtable.lock);
 }
 
 // Allocate a file structure.
@@ -52,6 +147,50 @@ filedup(struct file *f)
   return f;
 }
 
+// The open file behind descriptor fd of the current process, or 0.
+// When other threads share the descriptor table one of them may
+// close fd while the system call still uses the file, so it is held
+// until the call returns, see fileunhold.
+struct file*
+fileget(int fd)
+{
+  struct proc *p = myproc();
+  struct files *fs = p->files;
+  struct file *f;
+  int i;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  if(fs->ref < 2)
+    return fs->ofile[fd];
+  acquire(&fs->lock);
+  if((f = fs->ofile[fd]) != 0){
+    for(i = 0; i < NELEM(p->held); i++)
+      if(p->held[i] == 0)
+        break;
+    if(i == NELEM(p->held))
+      panic("fileget");
+    p->held[i] = filedup(f);
+  }
+  release(&fs->lock);
+  return f;
+}
+
+// Let go of the files p's system call held, see fileget.
+void
+fileunhold(struct proc *p)
+{
+  struct file *f;
+  int i;
+
+  for(i = 0; i < NELEM(p->held); i++){
+    if((f = p->held[i]) != 0){
+      p->held[i] = 0;
+      fileclose(f);
+    }
+  }
+}
+
 // Close file f.  (Decrement ref count, close when reaches 0.)
 void
 fileclose(struct file *f)
@@ -76,7 +215,8 @@ fileclose(struct file *f)
     begin_op();
     iput(ff.ip);
     end_op();
-  }
+  } else if(ff.type == FD_SEM)
+    semclose(ff.sem);
 }
 
 // Get metadata about file f.
@@ -84,7 +224,7 @@ int
 filestat(struct file *f, struct stat *st)
 {
   if(f->type == FD_INODE){
-    ilock(f->ip);
+    ilockshared(f->ip);
     stati(f->ip, st);
     iunlock(f->ip);
     return 0;
@@ -103,7 +243,13 @@ fileread(struct file *f, char *addr, int n)
   if(f->type == FD_PIPE)
     return piperead(f->pipe, addr, n);
   if(f->type == FD_INODE){
-    ilock(f->ip);
+    // f->off is advanced under the inode lock, so a file
+    // that is open in more than one place, or in a file
+    // table that threads share, is read exclusive.
+    if(f->ref > 1 || (myproc() && myproc()->files->ref > 1))
+      ilock(f->ip);
+    else
+      ilockshared(f->ip);
     if((r = readi(f->ip, addr, f->off, n)) > 0)
       f->off += r;
     iunlock(f->ip);
@@ -124,18 +270,12 @@ filewrite(struct file *f, char *addr, int n)
   if(f->type == FD_PIPE)
     return pipewrite(f->pipe, addr, n);
   if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
+    // write MAXWRITEOP bytes at a time
     int i = 0;
     while(i < n){
       int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
+      if(n1 > MAXWRITEOP)
+        n1 = MAXWRITEOP;
 
       begin_op();
       ilock(f->ip);
@@ -155,3 +295,46 @@ filewrite(struct file *f, char *addr, int n)
   panic("filewrite");
 }
 
+// Send n bytes of inode file in, from *off on, to out without
+// passing through user space, advancing *off. Returns the bytes
+// sent, 0 at the end of in, or -1.
+int
+filesend(struct file *out, struct file *in, uint32 *off, int n)
+{
+  int i, r, w, m;
+  char *mem;
+
+  if(out->type == FD_PIPE)
+    return pipesplicein(out->pipe, in->ip, off, n);
+  if(out->type != FD_INODE || (mem = kalloc()) == 0)
+    return -1;
+  for(i = 0, r = 0; i < n; i += r){
+    m = n - i < PGSIZE ? n - i : PGSIZE;
+    ilock(in->ip);
+    // readi fails past the end, which is just the end here
+    if(in->ip->type != T_DEV && *off >= in->ip->size)
+      r = 0;
+    else if((r = readi(in->ip, mem, *off, m)) > 0)
+      *off += r;
+    iunlock(in->ip);
+    if(r <= 0)
+      break;
+    for(w = 0; w < r; w += m){
+      m = r - w < MAXWRITEOP ? r - w : MAXWRITEOP;
+      begin_op();
+      ilock(out->ip);
+      if((m = writei(out->ip, mem + w, out->off, m)) > 0)
+        out->off += m;
+      iunlock(out->ip);
+      end_op();
+      if(m <= 0){
+        // give back what was read but not written
+        *off -= r - w;
+        kfree(mem);
+        return i + w > 0 ? i + w : -1;
+      }
+    }
+  }
+  kfree(mem);
+  return i > 0 ? i : r;
+}
@@ -1,13 +1,21 @@
 struct file {
-  enum { FD_NONE, FD_PIPE, FD_INODE , FD_FIFO} type;
+  enum { FD_NONE, FD_PIPE, FD_INODE , FD_FIFO, FD_SEM} type;
   int ref; // reference count
   char readable;
   char writable;
   struct pipe *pipe;
   struct inode *ip;
+  struct semaphore *sem;
   uint32 off;
 };
 
+// Bytes written to an inode per log transaction, a few blocks at a
+// time to avoid exceeding the maximum log transaction size, including
+// i-node, indirect block, allocation blocks, and 2 blocks of slop for
+// non-aligned writes. This really belongs lower down, since writei()
+// might be writing a device like the console.
+#define MAXWRITEOP (((MAXOPBLOCKS-1-1-2) / 2) * 512)
+
 
 // in-memory copy of an inode
 struct inode {
@@ -188,6 +188,9 @@ bfree(int dev, uint32 b) {
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+// ilockshared takes it shared, for code that only reads the inode
+// and its data (readi, dirlookup, namex), so that readers of the
+// same file or directory don't wait for each other.
 
 struct {
     struct spinlock lock;
@@ -392,9 +395,9 @@ ilock(struct inode *ip) {
 
     if (ip->valid == 0) {
         if (ip->dev == 2) {
-            bp = bread(ip->dev, IBLOCK(ip->inum, sb2));
+            bp = breadshared(ip->dev, IBLOCK(ip->inum, sb2));
         } else {
-            bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+            bp = breadshared(ip->dev, IBLOCK(ip->inum, sb));
 
         }
         dip = (struct dinode *) bp->data + ip->inum % IPB;
@@ -413,13 +416,32 @@ ilock(struct inode *ip) {
     }
 }
 
-// Unlock the given inode.
+// Lock the given inode shared, for reading it.
+// Reads the inode from disk if necessary.
+void
+ilockshared(struct inode *ip) {
+    if (ip == 0 || ip->ref < 1)
+        panic("ilockshared");
+
+    acquiresleepshared(&ip->lock);
+    if (ip->valid == 0) {
+        // loading it takes the lock exclusive
+        releasesleepshared(&ip->lock);
+        ilock(ip);
+        downgradesleep(&ip->lock);
+    }
+}
+
+// Unlock the given inode, locked either way.
 void
 iunlock(struct inode *ip) {
-    if (ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1)
+    if (ip == 0 || ip->ref < 1)
         panic("iunlock");
 
-    releasesleep(&ip->lock);
+    if (holdingsleep(&ip->lock))
+        releasesleep(&ip->lock);
+    else
+        releasesleepshared(&ip->lock);
 }
 
 // Drop a reference to an in-memory inode.
@@ -526,6 +548,28 @@ bmap(struct inode *ip, uint32 bn) {
     panic("bmap: out of range");
 }
 
+// Like bmap, but for readers: never allocates, returns 0 for a hole.
+static uint32
+bmapread(struct inode *ip, uint32 bn) {
+    uint32 addr;
+    struct buf *bp;
+
+    if (bn < NDIRECT)
+        return ip->addrs[bn];
+    bn -= NDIRECT;
+
+    if (bn < NINDIRECT) {
+        if ((addr = ip->addrs[NDIRECT]) == 0)
+            return 0;
+        bp = breadshared(ip->dev, addr);
+        addr = ((uint32 *) bp->data)[bn];
+        brelse(bp);
+        return addr;
+    }
+
+    panic("bmapread: out of range");
+}
+
 // Truncate inode (discard contents).
 // Only called when the inode has no links
 // to it (no directory entries referring to it)
@@ -564,13 +608,20 @@ itrunc(struct inode *ip) {
 // Caller must hold ip->lock.
 void
 stati(struct inode *ip, struct stat *st) {
-    if (ip->is_mount_point) {
-        st->dev = mounttable.mount_root->dev;
-        st->ino = mounttable.mount_root->inum;
-        st->type = mounttable.mount_root->type;
-        st->nlink = mounttable.mount_root->nlink;
-        st->size = mounttable.mount_root->size;
+    struct mounttable *m;
+
+    // a mount point looks like the root of what is mounted on it
+    rcu_read_lock();
+    if (ip->is_mount_point && (m = rcu_dereference(mounted)) != 0) {
+        st->dev = m->mount_root->dev;
+        st->ino = m->mount_root->inum;
+        st->type = m->mount_root->type;
+        st->nlink = m->mount_root->nlink;
+        st->size = m->mount_root->size;
+        rcu_read_unlock();
+        return;
     }
+    rcu_read_unlock();
     st->dev = ip->dev;
     st->ino = ip->inum;
     st->type = ip->type;
@@ -580,11 +631,11 @@ stati(struct inode *ip, struct stat *st) {
 
 //PAGEBREAK!
 // Read data from inode.
-// Caller must hold ip->lock.
+// Caller must hold ip->lock, shared is enough.
 int
 readi(struct inode *ip, char *dst, uint32 off, uint32 n) {
 
-    uint32 tot, m;
+    uint32 tot, m, addr;
     struct buf *bp;
 
     if (ip->type == T_DEV) {
@@ -599,8 +650,12 @@ readi(struct inode *ip, char *dst, uint32 off, uint32 n) {
         n = ip->size - off;
 
     for (tot = 0; tot < n; tot += m, off += m, dst += m) {
-        bp = bread(ip->dev, bmap(ip, off / BSIZE));
         m = min(n - tot, BSIZE - off % BSIZE);
+        if ((addr = bmapread(ip, off / BSIZE)) == 0) {
+            memset(dst, 0, m);
+            continue;
+        }
+        bp = breadshared(ip->dev, addr);
         memmove(dst, bp->data + off % BSIZE, m);
         brelse(bp);
     }
@@ -676,12 +731,14 @@ namecmp(const char *s, const char *t) {
 
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// Caller must hold dp->lock, shared is enough.
 struct inode *
 dirlookup(struct inode *dp, char *name, uint32 *poff, uint32 leaving_mount) {
+    struct inode *root = 0, *ip = 0;
 
     if (!leaving_mount) {
-        if (dp->is_mount_point) {
-            dp = mounttable.mount_root;
+        if (dp->is_mount_point && (root = mountedroot()) != 0) {
+            dp = root;
         }
     }
 
@@ -701,18 +758,23 @@ dirlookup(struct inode *dp, char *name, uint32 *poff, uint32 leaving_mount) {
             if (poff)
                 *poff = off;
             inum = de.inum;
-            return iget(dp->dev, inum);
+            ip = iget(dp->dev, inum);
+            break;
         }
     }
 
-    return 0;
+    if (root)
+        iput(root);
+    return ip;
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
 int
 dirlink(struct inode *dp, char *name, uint32 inum) {
-    if (dp->is_mount_point) {
-        dp = mounttable.mount_root;
+    struct inode *root = 0;
+
+    if (dp->is_mount_point && (root = mountedroot()) != 0) {
+        dp = root;
     }
     int off;
     struct dirent de;
@@ -721,6 +783,8 @@ dirlink(struct inode *dp, char *name, uint32 inum) {
     // Check that name is not present.
     if ((ip = dirlookup(dp, name, 0,0)) != 0) {
         iput(ip);
+        if (root)
+            iput(root);
         return -1;
     }
 
@@ -739,6 +803,8 @@ dirlink(struct inode *dp, char *name, uint32 inum) {
         panic("dirlink");
 
     iupdate(dp);
+    if (root)
+        iput(root);
     return 0;
 }
 
@@ -787,16 +853,16 @@ skipelem(char *path, char *name) {
 // Must be called inside a transaction since it calls iput().
 static struct inode *
 namex(uint32 dev, char *path, int nameiparent, char *name) {
-    struct inode *ip, *next;
+    struct inode *ip, *next, *root;
 
     if (*path == '/') {
         ip = iget(dev, ROOTINO);
     } else
-        ip = idup(myproc()->cwd);
+        ip = idup(myproc()->files->cwd);
 
 
     while ((path = skipelem(path, name)) != 0) {
-        ilock(ip);
+        ilockshared(ip);
         if (ip->type != T_DIR) {
             iunlockput(ip);
             return 0;
@@ -812,8 +878,8 @@ namex(uint32 dev, char *path, int nameiparent, char *name) {
             iunlockput(ip);
             return 0;
         }
-        if (!nameiparent && next->is_mount_point) {
-            next = idup(mounttable.mount_root);
+        if (!nameiparent && next->is_mount_point && (root = mountedroot()) != 0) {
+            next = root;
         }
         iunlockput(ip);
         ip = next;
@@ -829,19 +895,26 @@ namex(uint32 dev, char *path, int nameiparent, char *name) {
 struct inode *
 namei(uint32 dev, char *path) {
     if (dev == 0) {
-        dev = myproc()->cwd->dev;
+        dev = myproc()->files->cwd->dev;
     }
     char name[DIRSIZ];
 
     //Is this inside the root of a mount point referencing the parent inode? If so, we need to move across mount points
     // I should get this set up to get the parent however I will need to write a new function I believe since all getting of parent inode is done via path, which I won't have a path just
     //an inode pointer. This solution is fine for now.
-    if (dev > 1 && (*path == '.' && path[1] == '.') && (myproc()->cwd->inum == ROOTINO)) {
-        struct inode *old_cwd = myproc()->cwd;
-        myproc()->cwd = mounttable.mount_point;
+    struct mounttable *m;
+    struct inode *mount_point = 0;
+
+    rcu_read_lock();
+    if ((m = rcu_dereference(mounted)) != 0)
+        mount_point = m->mount_point;
+    rcu_read_unlock();
+    if (dev > 1 && (*path == '.' && path[1] == '.') && (myproc()->files->cwd->inum == ROOTINO) && mount_point) {
+        struct inode *old_cwd = myproc()->files->cwd;
+        myproc()->files->cwd = mount_point;
         iput(old_cwd);
         struct inode *new = namex(1, "../..", 1, name);
-        myproc()->cwd = new;
+        myproc()->files->cwd = new;
         iput(old_cwd);
         return new;
     }
@@ -30,12 +30,27 @@ struct superblock superblock;
 
 struct nonblockinglock mountlock;
 
-struct mounttable mounttable = {NULL, NULL, NULL};
+static struct mounttable mounttable = {NULL, NULL, NULL};
+struct mounttable *mounted;
 
 void init_mount_lock() {
     initnonblockinglock(&mountlock, "mountlock");
 }
 
+/*
+ * The root of the mounted file system, with a reference taken, or 0 if nothing is mounted.
+ */
+struct inode *mountedroot(void) {
+    struct mounttable *m;
+    struct inode *ip = 0;
+
+    rcu_read_lock();
+    if ((m = rcu_dereference(mounted)) != 0)
+        ip = idup(m->mount_root);
+    rcu_read_unlock();
+    return ip;
+}
+
 /*
  * The mount function for our mounting functionality. It will take a path mountpoint
  */
@@ -108,18 +123,18 @@ int mount(uint32 dev, char *path) {
     //mount point and then just using . as a path so it will go from cwd. It maybe makes more sense to write new functions than to do this
     //but for now this is ok.
     if (mountpoint->type != T_DIR) {
-        struct inode *old_cwd = myproc()->cwd;
-        myproc()->cwd = idup(mountpoint);
+        struct inode *old_cwd = myproc()->files->cwd;
+        myproc()->files->cwd = idup(mountpoint);
         //now that we swapped our cwd out , . will select the relative entry that will allow this mount to work properly.
         struct inode *dir_check = namei(mountpoint->dev,".");
         if(dir_check && dir_check->type == T_DIR){
             mountpoint = idup(dir_check);
             iput(dir_check);
-            myproc()->cwd = old_cwd;
+            myproc()->files->cwd = old_cwd;
             goto fixed;
 
         }
-        myproc()->cwd = old_cwd;
+        myproc()->files->cwd = old_cwd;
         //dont try to put a null pointer
         if(dir_check){
             iput(dir_check);
@@ -148,10 +163,11 @@ int mount(uint32 dev, char *path) {
         return -EMOUNTROOTNOTFOUND;
     }
 
-    mountpoint->is_mount_point = 1;
     mounttable.lock = &mountlock.lk;
     mounttable.mount_point = mountpoint;
     mounttable.mount_root = mountroot;
+    rcu_assign_pointer(mounted, &mounttable);
+    mountpoint->is_mount_point = 1;
     end_op();
 
     return 0;
@@ -180,12 +196,16 @@ int unmount(char *mountpoint) {
     }
     //put the mount pointer so we can reduce the ref count to what SHOULD be 1 (just the mount table inode) which we will check for below in iputmount
     iput(mp);
+    //take the mount away first and wait for the readers that may have seen it, after that no one can pick up a new reference to the root
+    mounttable.mount_point->is_mount_point = 0;
+    rcu_assign_pointer(mounted, 0);
+    synchronize_rcu();
     if (iputmount(mounttable.mount_root) != 0) {
         cprintf("ref count : %d\n",mp->ref);
-
+        mounttable.mount_point->is_mount_point = 1;
+        rcu_assign_pointer(mounted, &mounttable);
         return -EMOUNTPOINTBUSY;
     }
-    mounttable.mount_point->is_mount_point = 0;
     mounttable.mount_point = 0;
     mounttable.mount_root = 0;
     releasenonblocking(&mountlock);
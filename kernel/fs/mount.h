@@ -25,6 +25,12 @@ struct mounttable{
     struct inode *mount_root;
 };
 
-extern struct mounttable mounttable;
+/*
+ * The mount in effect, or 0. Readers take no lock, they use it under rcu_read_lock
+ * (see mountedroot). unmount takes it away and waits a grace period before it lets go
+ * of the inodes.
+ */
+extern struct mounttable *mounted;
 void init_mount_lock();
+struct inode *mountedroot(void);
 #endif //XV6I386_MOUNT_H
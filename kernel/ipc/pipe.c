@@ -1,28 +1,54 @@
 #include "../../user/types.h"
 #include "../defs/defs.h"
 #include "../defs/param.h"
+#include "../../user/stat.h"
+#include "../arch/x86_32/mem/memlayout.h"
 #include "../arch/x86_32/mem/mmu.h"
 #include "../lock/spinlock.h"
+#include "../lock/sleeplock.h"
 #include "../sched/proc.h"
+#include "../mm/vmspace.h"
+#include "../arch/x86_32/mem/vm.h"
 #include "../fs/fs.h"
-#include "../lock/sleeplock.h"
 #include "../fs/file.h"
 
-#define PIPESIZE 512
+// The ring is PIPEPAGES separate pages, so it need not be contiguous.
+// A power of two, so nread and nwrite can wrap.
+#define PIPESIZE (PIPEPAGES*PGSIZE)
 
+// Writers take wlock and readers rlock, one of each at a time. The
+// writer owns the free part of the ring and the reader the part
+// holding data, so the splice functions copy in and out (or trade
+// whole pages) without p->lock, which only guards nread and nwrite.
+// A holder may sleep for as long as the pipe stays full or empty,
+// so the others wait for wlock and rlock killable.
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  struct sleeplock rlock;
+  struct sleeplock wlock;
+  char *pages[PIPEPAGES];
   uint32 nread;     // number of bytes read
   uint32 nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
 };
 
+static void
+pipefree(struct pipe *p)
+{
+  int i;
+
+  for(i = 0; i < PIPEPAGES; i++)
+    if(p->pages[i])
+      kfree(p->pages[i]);
+  kfree((char*)p);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
   struct pipe *p;
+  int i;
 
   p = 0;
   *f0 = *f1 = 0;
@@ -30,11 +56,17 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((p = (struct pipe*)kalloc()) == 0)
     goto bad;
+  memset(p->pages, 0, sizeof(p->pages));
+  for(i = 0; i < PIPEPAGES; i++)
+    if((p->pages[i] = kalloc()) == 0)
+      goto bad;
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
   p->nread = 0;
   initlock(&p->lock, "pipe");
+  initsleeplock(&p->rlock, "piperead");
+  initsleeplock(&p->wlock, "pipewrite");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
@@ -48,7 +80,7 @@ pipealloc(struct file **f0, struct file **f1)
 //PAGEBREAK: 20
  bad:
   if(p)
-    kfree((char*)p);
+    pipefree(p);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -69,31 +101,116 @@ pipeclose(struct pipe *p, int writable)
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
-    kfree((char*)p);
+    pipefree(p);
   } else
     release(&p->lock);
 }
 
+// The helpers below are called with p->lock held. The copies into
+// and out of the ring are made with it let go, interrupts stay on.
+
+// Wait until there is room in p. Returns -1 if nobody is going to read it.
+static int
+waitroom(struct pipe *p)
+{
+  while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
+    if(p->readopen == 0 || myproc()->killed)
+      return -1;
+    sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
+  }
+  return 0;
+}
+
+// Wait until there is data in p, or no writer. Returns -1 if killed.
+static int
+waitdata(struct pipe *p)
+{
+  while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
+    if(myproc()->killed)
+      return -1;
+    sleep(&p->nread, &p->lock); //DOC: piperead-sleep
+  }
+  return 0;
+}
+
+// Bytes from position off of the ring up to the end of its page.
+static uint32
+pagerest(uint32 off)
+{
+  return PGSIZE - off % PGSIZE;
+}
+
+// Where the next write goes. Sets *m to how much fits there
+// without crossing a page of the ring.
+static char*
+wspan(struct pipe *p, uint32 *m)
+{
+  uint32 off = p->nwrite % PIPESIZE;
+
+  *m = PIPESIZE - (p->nwrite - p->nread);
+  if(*m > pagerest(off))
+    *m = pagerest(off);
+  return p->pages[off / PGSIZE] + off % PGSIZE;
+}
+
+// Where the next read comes from, and in *m how much is there
+// up to the end of its page.
+static char*
+rspan(struct pipe *p, uint32 *m)
+{
+  uint32 off = p->nread % PIPESIZE;
+
+  *m = p->nwrite - p->nread;
+  if(*m > pagerest(off))
+    *m = pagerest(off);
+  return p->pages[off / PGSIZE] + off % PGSIZE;
+}
+
+// Readers only sleep on an empty pipe and writers on a full one,
+// so the wakeups are only needed when a copy ends either state.
+static void
+advwrite(struct pipe *p, uint32 m)
+{
+  if(p->nwrite == p->nread)
+    wakeup(&p->nread);  //DOC: pipewrite-wakeup1
+  p->nwrite += m;
+}
+
+static void
+advread(struct pipe *p, uint32 m)
+{
+  if(p->nwrite == p->nread + PIPESIZE)
+    wakeup(&p->nwrite);  //DOC: piperead-wakeup
+  p->nread += m;
+}
+
 //PAGEBREAK: 40
 int
 pipewrite(struct pipe *p, char *addr, int n)
 {
   int i;
+  uint32 m;
+  char *dst;
 
-  acquire(&p->lock);
-  for(i = 0; i < n; i++){
-    while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
-      if(p->readopen == 0 || myproc()->killed){
-        release(&p->lock);
-        return -1;
-      }
-      wakeup(&p->nread);
-      sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
+  if(acquiresleepkillable(&p->wlock) < 0)
+    return -1;
+  for(i = 0; i < n; i += m){
+    acquire(&p->lock);
+    if(waitroom(p) < 0){
+      release(&p->lock);
+      releasesleep(&p->wlock);
+      return -1;
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    dst = wspan(p, &m);
+    release(&p->lock);
+    if(m > n - i)
+      m = n - i;
+    memmove(dst, addr + i, m);
+    acquire(&p->lock);
+    advwrite(p, m);
+    release(&p->lock);
   }
-  wakeup(&p->nread);  //DOC: pipewrite-wakeup1
-  release(&p->lock);
+  releasesleep(&p->wlock);
   return n;
 }
 
@@ -101,21 +218,250 @@ int
 piperead(struct pipe *p, char *addr, int n)
 {
   int i;
+  uint32 m;
+  char *src;
 
+  if(acquiresleepkillable(&p->rlock) < 0)
+    return -1;
   acquire(&p->lock);
-  while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
-    if(myproc()->killed){
+  if(waitdata(p) < 0){
+    release(&p->lock);
+    releasesleep(&p->rlock);
+    return -1;
+  }
+  release(&p->lock);
+  for(i = 0; i < n; i += m){  //DOC: piperead-copy
+    acquire(&p->lock);
+    src = rspan(p, &m);
+    release(&p->lock);
+    if(m == 0)
+      break;
+    if(m > n - i)
+      m = n - i;
+    memmove(addr + i, src, m);
+    acquire(&p->lock);
+    advread(p, m);
+    release(&p->lock);
+  }
+  releasesleep(&p->rlock);
+  return i;
+}
+
+/*
+ * Read up to n bytes of inode ip from *off on straight into the ring,
+ * advancing *off. Waits for room like pipewrite. Returns the bytes
+ * moved, 0 at the end of the file, or -1.
+ */
+int
+pipesplicein(struct pipe *p, struct inode *ip, uint32 *off, int n)
+{
+  int i, r;
+  uint32 m;
+  char *dst;
+
+  if(acquiresleepkillable(&p->wlock) < 0)
+    return -1;
+  for(i = 0, r = 0; i < n; i += r){
+    acquire(&p->lock);
+    if(waitroom(p) < 0){
       release(&p->lock);
-      return -1;
+      r = -1;
+      break;
     }
-    sleep(&p->nread, &p->lock); //DOC: piperead-sleep
-  }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
+    dst = wspan(p, &m);
+    release(&p->lock);
+    if(m > n - i)
+      m = n - i;
+    ilock(ip);
+    // readi fails past the end, which is just the end here
+    if(ip->type != T_DEV && *off >= ip->size)
+      r = 0;
+    else if((r = readi(ip, dst, *off, m)) > 0)
+      *off += r;
+    iunlock(ip);
+    if(r <= 0)
       break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+    acquire(&p->lock);
+    advwrite(p, r);
+    release(&p->lock);
   }
-  wakeup(&p->nwrite);  //DOC: piperead-wakeup
+  releasesleep(&p->wlock);
+  return i > 0 ? i : r;
+}
+
+/*
+ * Write what the pipe holds, up to n bytes, to file f at its offset,
+ * waiting for data like piperead. Returns the bytes moved, 0 if the
+ * pipe is empty with no writer left, or -1.
+ */
+int
+pipespliceout(struct pipe *p, struct file *f, int n)
+{
+  int i, r;
+  uint32 m;
+  char *src;
+
+  if(acquiresleepkillable(&p->rlock) < 0)
+    return -1;
+  acquire(&p->lock);
+  r = waitdata(p);
   release(&p->lock);
-  return i;
+  for(i = 0; r >= 0 && i < n; i += r){
+    acquire(&p->lock);
+    src = rspan(p, &m);
+    release(&p->lock);
+    if(m == 0)
+      break;
+    if(m > n - i)
+      m = n - i;
+    if(m > MAXWRITEOP)
+      m = MAXWRITEOP;
+    begin_op();
+    ilock(f->ip);
+    if((r = writei(f->ip, src, f->off, m)) > 0)
+      f->off += r;
+    iunlock(f->ip);
+    end_op();
+    if(r <= 0){
+      r = -1;
+      break;
+    }
+    acquire(&p->lock);
+    advread(p, r);
+    release(&p->lock);
+    if(r != m){
+      i += r;
+      break;
+    }
+  }
+  releasesleep(&p->rlock);
+  return i > 0 ? i : (r < 0 ? -1 : 0);
+}
+
+/*
+ * Move up to n bytes from pipe in to pipe out. Whole pages change
+ * rings by trading places with a free page of out, without a copy.
+ * Waits for data in in and room in out. Returns the bytes moved,
+ * 0 if in is empty with no writer left, or -1.
+ */
+int
+pipesplice(struct pipe *in, struct pipe *out, int n)
+{
+  int i, r;
+  uint32 m, room, sidx, didx;
+  char *src, *dst, *t;
+
+  if(in == out)
+    return -1;
+  if(acquiresleepkillable(&in->rlock) < 0)
+    return -1;
+  if(acquiresleepkillable(&out->wlock) < 0){
+    releasesleep(&in->rlock);
+    return -1;
+  }
+  acquire(&in->lock);
+  r = waitdata(in);
+  release(&in->lock);
+  for(i = 0; r >= 0 && i < n; i += m){
+    acquire(&in->lock);
+    src = rspan(in, &m);
+    sidx = (in->nread % PIPESIZE) / PGSIZE;
+    release(&in->lock);
+    if(m == 0)
+      break;
+    acquire(&out->lock);
+    if((r = waitroom(out)) < 0){
+      release(&out->lock);
+      break;
+    }
+    dst = wspan(out, &room);
+    didx = (out->nwrite % PIPESIZE) / PGSIZE;
+    release(&out->lock);
+    if(m > room)
+      m = room;
+    if(m > n - i)
+      m = n - i;
+    if(m == PGSIZE){
+      // both at the start of a page
+      t = in->pages[sidx];
+      in->pages[sidx] = out->pages[didx];
+      out->pages[didx] = t;
+    } else
+      memmove(dst, src, m);
+    acquire(&out->lock);
+    advwrite(out, m);
+    release(&out->lock);
+    acquire(&in->lock);
+    advread(in, m);
+    release(&in->lock);
+  }
+  releasesleep(&out->wlock);
+  releasesleep(&in->rlock);
+  return i > 0 ? i : (r < 0 ? -1 : 0);
+}
+
+// Put the user page at va into the ring in place of *slot, and a zeroed
+// page into the address space in its place. Only whole pages of the heap
+// and stack qualify, mmap areas and shared memory have other owners.
+// Returns 0, or -1 if the page has to be copied instead.
+static int
+giftpage(struct vmspace *vm, uint32 va, char **slot)
+{
+  pte_t *pte;
+  char *mem;
+
+  acquiresleep(&vm->lock);
+  if(!(va + PGSIZE <= vm->sz || (va >= vm->stack_base && va < STACK_BASE)))
+    goto bad;
+  if((pte = walkpgdir(vm->pgdir, (void*)va, 0)) == 0 || pte == &vm->pgdir[PDX(va)])
+    goto bad;
+  if((*pte & (PTE_P|PTE_W|PTE_U)) != (PTE_P|PTE_W|PTE_U) || (mem = kalloc_zeroed()) == 0)
+    goto bad;
+  kfree(*slot);
+  *slot = P2V(PTE_ADDR(*pte));
+  *pte = V2P(mem) | PTE_FLAGS(*pte);
+  tlbflush(vm);
+  releasesleep(&vm->lock);
+  return 0;
+
+ bad:
+  releasesleep(&vm->lock);
+  return -1;
+}
+
+/*
+ * Write n bytes at user address addr into the pipe, like pipewrite, but
+ * page-aligned whole pages of the caller's heap or stack are given to
+ * the pipe rather than copied. They read as zeroes afterwards.
+ */
+int
+pipegift(struct pipe *p, char *addr, int n)
+{
+  struct vmspace *vm = myproc()->vm;
+  int i;
+  uint32 m, idx;
+  char *dst;
+
+  if(acquiresleepkillable(&p->wlock) < 0)
+    return -1;
+  for(i = 0; i < n; i += m){
+    acquire(&p->lock);
+    if(waitroom(p) < 0){
+      release(&p->lock);
+      releasesleep(&p->wlock);
+      return -1;
+    }
+    dst = wspan(p, &m);
+    idx = (p->nwrite % PIPESIZE) / PGSIZE;
+    release(&p->lock);
+    if(m > n - i)
+      m = n - i;
+    if(m != PGSIZE || (uint32)(addr + i) % PGSIZE != 0 || giftpage(vm, (uint32)(addr + i), &p->pages[idx]) < 0)
+      memmove(dst, addr + i, m);
+    acquire(&p->lock);
+    advwrite(p, m);
+    release(&p->lock);
+  }
+  releasesleep(&p->wlock);
+  return n;
 }
@@ -0,0 +1,130 @@
+//
+// Named shared memory segments.
+//
+// shmcreate makes a zeroed segment and attaches it, shmattach maps an existing segment by
+// name and shmdetach unmaps it again. Every attachment, including the ones a child inherits
+// on fork, holds a reference. The pages are freed and the name goes away on the last detach.
+// MAP_SHARED | MAP_ANONYMOUS areas are backed by segments without a name, which only the
+// area and the copies of it that fork makes reach.
+//
+// This file only keeps the table of segments, the page table side lives with the other
+// mapped areas in mm/mmap.c.
+//
+
+#include "../../user/types.h"
+#include "../defs/defs.h"
+#include "../defs/param.h"
+#include "../arch/x86_32/mem/mmu.h"
+#include "../lock/spinlock.h"
+#include "shm.h"
+
+struct {
+    struct spinlock lock;
+    struct shm shm[NSHM];
+} shmtable;
+
+void
+shminit(void) {
+    initlock(&shmtable.lock, "shm");
+}
+
+static struct shm *
+shmfind(char *name) {
+    struct shm *s;
+
+    for (s = shmtable.shm; s < &shmtable.shm[NSHM]; s++) {
+        if (s->ref && s->name[0] && strncmp(s->name, name, SHMNAME) == 0)
+            return s;
+    }
+    return 0;
+}
+
+static void
+shmfree(struct shm *s) {
+    int i;
+
+    for (i = 0; i < s->size / PGSIZE; i++) {
+        if (s->pages[i]) {
+            kfree(s->pages[i]);
+            countuser(-1);
+        }
+        s->pages[i] = 0;
+    }
+    s->size = 0;
+    s->name[0] = 0;
+}
+
+/*
+ * Make a new zeroed segment of size bytes called name, or without a name if name is 0,
+ * holding one reference. Returns 0 if the name is taken or there is no room.
+ */
+struct shm *
+shmalloc(char *name, uint32 size) {
+    struct shm *s, *free;
+    int i;
+
+    size = PGROUNDUP(size);
+    if (size == 0 || size > SHMMAXPAGES * PGSIZE || (name && name[0] == 0))
+        return 0;
+
+    acquire(&shmtable.lock);
+    free = 0;
+    for (s = shmtable.shm; s < &shmtable.shm[NSHM]; s++) {
+        if (s->ref == 0 && free == 0)
+            free = s;
+    }
+    if ((name && shmfind(name)) || (s = free) == 0) {
+        release(&shmtable.lock);
+        return 0;
+    }
+
+    s->size = size;
+    safestrcpy(s->name, name ? name : "", SHMNAME);
+    for (i = 0; i < size / PGSIZE; i++) {
+        if ((s->pages[i] = kalloc_zeroed()) == 0) {
+            shmfree(s);
+            release(&shmtable.lock);
+            return 0;
+        }
+        countuser(1);
+    }
+    s->ref = 1;
+    release(&shmtable.lock);
+    return s;
+}
+
+/*
+ * Look up the segment called name and take a reference to it.
+ */
+struct shm *
+shmlookup(char *name) {
+    struct shm *s;
+
+    acquire(&shmtable.lock);
+    if ((s = shmfind(name)) != 0)
+        s->ref++;
+    release(&shmtable.lock);
+    return s;
+}
+
+void
+shmdup(struct shm *s) {
+    acquire(&shmtable.lock);
+    if (s->ref < 1)
+        panic("shmdup");
+    s->ref++;
+    release(&shmtable.lock);
+}
+
+/*
+ * Drop a reference, the last one frees the pages.
+ */
+void
+shmput(struct shm *s) {
+    acquire(&shmtable.lock);
+    if (s->ref < 1)
+        panic("shmput");
+    if (--s->ref == 0)
+        shmfree(s);
+    release(&shmtable.lock);
+}
@@ -0,0 +1,10 @@
+#define SHMNAME 16  // max length of a segment name, including the 0
+
+// A named shared memory segment. The same physical pages are mapped
+// into every process that has the segment attached, see ipc/shm.c.
+struct shm {
+    char name[SHMNAME];
+    uint32 size;                  // Bytes, page aligned
+    int ref;                      // Attachments, 0 means the slot is free
+    char *pages[SHMMAXPAGES];     // Kernel addresses of the pages
+};
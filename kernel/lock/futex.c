@@ -0,0 +1,135 @@
+// Futexes: sleeping on an int in user memory.
+//
+// A user lock does all its work with atomic instructions on a word
+// of its own and only makes a system call when it has to wait, or
+// when it knows someone is waiting. The kernel side is a set of wait
+// queues hashed on the word's physical address.
+//
+// FUTEX_WAIT checks the word with its queue's lock held and wake
+// takes the same lock, so a wake that follows the user's store to
+// the word can't slip in between the check and the sleep. Waiters
+// queue in the order they came, and each sleeps on its own entry,
+// so a wake of one doesn't get every waiter out of bed.
+
+#include "../../user/types.h"
+#include "../defs/defs.h"
+#include "../defs/param.h"
+#include "../arch/x86_32/mem/memlayout.h"
+#include "../arch/x86_32/mem/mmu.h"
+#include "../arch/x86_32/mem/vm.h"
+#include "../algorithms/hash.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "../sched/proc.h"
+#include "../mm/vmspace.h"
+#include "futex.h"
+
+#define NFUTEXQ 64  // wait queues, a power of two
+
+struct futexwaiter {
+  uint32 key;                 // physical address waited on
+  int woken;
+  struct futexwaiter *next;
+};
+
+static struct futexq {
+  struct spinlock lock;
+  struct futexwaiter *head;
+  struct futexwaiter **tail;
+} futexq[NFUTEXQ];
+
+void
+futexinit(void)
+{
+  struct futexq *q;
+
+  for(q = futexq; q < &futexq[NFUTEXQ]; q++){
+    initlock(&q->lock, "futex");
+    q->tail = &q->head;
+  }
+}
+
+// Physical address of the user word at va. The system call has
+// already brought its page in (argptrw), and the page stays put
+// while the process is in the kernel.
+static uint32
+futexkey(uint32 va)
+{
+  pte_t *pte;
+
+  if((pte = walkpgdir(myproc()->vm->pgdir, (void*)va, 0)) == 0 || !(*pte & PTE_P))
+    return 0;
+  if(*pte & PTE_PS)
+    return (PTE_ADDR(*pte) & ~(LPGSIZE-1)) | (va & (LPGSIZE-1));
+  return PTE_ADDR(*pte) | (va & (PGSIZE-1));
+}
+
+static struct futexq *
+futexhash(uint32 key)
+{
+  return &futexq[hash_8(key >> 2) & (NFUTEXQ-1)];
+}
+
+// Sleep until woken if *addr is val.
+int
+futexwait(uint32 *addr, int val)
+{
+  struct futexwaiter w, **pw;
+  struct futexq *q;
+  struct proc *p = myproc();
+
+  if((uint32)addr % 4 || (w.key = futexkey((uint32)addr)) == 0)
+    return -1;
+  w.woken = 0;
+  w.next = 0;
+  q = futexhash(w.key);
+
+  acquire(&q->lock);
+  if(*(volatile int*)P2V(w.key) != val){
+    release(&q->lock);
+    return -1;
+  }
+  *q->tail = &w;
+  q->tail = &w.next;
+  while(!w.woken && !p->killed)
+    sleep(&w, &q->lock);
+  if(!w.woken){
+    // killed: take ourselves off the queue
+    for(pw = &q->head; *pw != &w; pw = &(*pw)->next)
+      ;
+    if((*pw = w.next) == 0)
+      q->tail = pw;
+  }
+  release(&q->lock);
+  return w.woken ? 0 : -1;
+}
+
+// Wake up to n of the processes waiting on addr, longest waiting first.
+int
+futexwake(uint32 *addr, int n)
+{
+  struct futexwaiter *w, **pw;
+  struct futexq *q;
+  uint32 key;
+  int woken;
+
+  if((uint32)addr % 4 || (key = futexkey((uint32)addr)) == 0)
+    return -1;
+  q = futexhash(key);
+  woken = 0;
+
+  acquire(&q->lock);
+  for(pw = &q->head; (w = *pw) != 0 && woken < n; ){
+    if(w->key != key){
+      pw = &w->next;
+      continue;
+    }
+    if((*pw = w->next) == 0)
+      q->tail = pw;
+    w->woken = 1;
+    wakeup(w);
+    woken++;
+  }
+  release(&q->lock);
+  return woken;
+}
@@ -0,0 +1,10 @@
+// Operations of the futex system call, futex(addr, op, val).
+//
+// FUTEX_WAIT sleeps if the int at addr still holds val, and returns
+// 0 once woken, or -1 straight away if it doesn't. FUTEX_WAKE wakes
+// up to val processes waiting on addr and returns how many it woke.
+// Waiters are found by physical address, so addr may be in shared
+// memory and mapped somewhere else in each process.
+
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
@@ -0,0 +1,135 @@
+// Lock contention statistics.
+//
+// initlock and initsleeplock give each lock the id of its name, so that
+// all the locks called "buffer" are counted together. acquire and
+// acquiresleep count every acquisition; only one that had to wait reads
+// the TSC to time the wait. The hold time costs a TSC read on each side.
+//
+// Each CPU counts in a table of its own, with the lock held and interrupts
+// off, so counting needs no atomic instructions and shares no cache lines.
+// The lockstat system call adds the tables up.
+
+#include "../../user/types.h"
+#include "../defs/defs.h"
+#include "../defs/param.h"
+#include "../arch/x86_32/x86.h"
+#include "../arch/x86_32/mem/mmu.h"
+#include "lockstat.h"
+
+struct lockcount {
+  uint32 nacquire;
+  uint32 ncontended;
+  uint32 nspin;
+  uint32 nspinok;
+  uint64 waitcycles;
+  uint64 maxhold;
+};
+
+static struct {
+  uint32 busy;                    // taken by lockstatid, a spinlock can't be used here
+  int n;                          // ids handed out, 0 is never used
+  char name[NLOCKSTAT][LOCKNAME];
+  uint8 sleep[NLOCKSTAT];
+} names;
+
+static struct lockcount counts[NCPU][NLOCKSTAT];
+
+// The id for locks called name, making one up if it is new.
+// Called by initlock, which may run before there is a mycpu().
+int
+lockstatid(char *name, int sleep)
+{
+  uint32 eflags;
+  int id;
+
+  if(name == 0)
+    return 0;
+  eflags = readeflags();
+  cli();
+  while(xchg(&names.busy, 1) != 0)
+    pause();
+  for(id = 1; id <= names.n; id++)
+    if(names.sleep[id] == sleep && strncmp(names.name[id], name, LOCKNAME - 1) == 0)
+      break;
+  if(id > names.n){
+    if(names.n < NLOCKSTAT - 2){
+      id = ++names.n;
+      safestrcpy(names.name[id], name, LOCKNAME);
+      names.sleep[id] = sleep;
+    } else {
+      id = names.n = NLOCKSTAT - 1;
+      safestrcpy(names.name[id], "(other)", LOCKNAME);
+    }
+  }
+  xchg(&names.busy, 0);
+  if(eflags & FL_IF)
+    sti();
+  return id;
+}
+
+// Count an acquisition on this CPU, cpu, that waited wait cycles (0 if it didn't).
+void
+lockstatacquire(int id, int cpu, uint64 wait)
+{
+  struct lockcount *c = &counts[cpu][id];
+
+  c->nacquire++;
+  if(wait){
+    c->ncontended++;
+    c->waitcycles += wait;
+  }
+}
+
+// Count a sleep lock wait that spun first, and whether the spin was enough.
+void
+lockstatspin(int id, int cpu, int ok)
+{
+  struct lockcount *c = &counts[cpu][id];
+
+  c->nspin++;
+  if(ok)
+    c->nspinok++;
+}
+
+// Note how long the lock was held, on release.
+void
+lockstatrelease(int id, int cpu, uint64 hold)
+{
+  struct lockcount *c = &counts[cpu][id];
+
+  if(hold > c->maxhold)
+    c->maxhold = hold;
+}
+
+// Copy out up to n entries, the counts of all CPUs added up.
+// Returns the number copied.
+int
+lockstatread(struct lockstatent *e, int n)
+{
+  struct lockcount *c;
+  int id, i;
+
+  for(id = 1; id <= names.n && id <= n; id++, e++){
+    memset(e, 0, sizeof(*e));
+    safestrcpy(e->name, names.name[id], LOCKNAME);
+    e->sleep = names.sleep[id];
+    for(i = 0; i < NCPU; i++){
+      c = &counts[i][id];
+      e->nacquire += c->nacquire;
+      e->ncontended += c->ncontended;
+      e->nspin += c->nspin;
+      e->nspinok += c->nspinok;
+      e->waitcycles += c->waitcycles;
+      if(c->maxhold > e->maxhold)
+        e->maxhold = c->maxhold;
+    }
+  }
+  return id - 1;
+}
+
+// Start counting again from zero.
+void
+lockstatreset(void)
+{
+  memset(counts, 0, sizeof(counts));
+}
@@ -0,0 +1,17 @@
+// Lock contention counters, returned by the lockstat system call.
+// They are kept per lock name, so all the locks called "buffer"
+// add up to one entry, and cycles are TSC cycles.
+
+#define LOCKNAME 16   // bytes of a lock's name that are kept
+#define NLOCKSTAT 64  // lock names counted; the last one takes all the rest
+
+struct lockstatent {
+  char name[LOCKNAME];
+  uint32 sleep;        // 1 for sleep locks, 0 for spin locks
+  uint32 nacquire;     // times taken
+  uint32 ncontended;   // times it had to wait for another holder
+  uint32 nspin;        // sleep locks: waits that spun on a running holder
+  uint32 nspinok;      // and got the lock without sleeping after all
+  uint64 waitcycles;   // total time spent waiting
+  uint64 maxhold;      // longest time it was held
+};
@@ -0,0 +1,123 @@
+// Read-copy update.
+//
+// Readers of a structure kept this way use it between rcu_read_lock and
+// rcu_read_unlock, which only turn interrupts off, so a reader can't be
+// switched out. A CPU that is back in its scheduler loop is done with
+// everything it read before; that is its quiescent state.
+//
+// A writer publishes the new version of the structure with
+// rcu_assign_pointer and hands what it took out to call_rcu. Once every
+// CPU has been through a quiescent state after that (a grace period) no
+// reader can still be looking at it, and the callback runs.
+// synchronize_rcu waits for a grace period instead.
+//
+// call_rcu queues callbacks on next. A grace period moves them to wait
+// and sets a bit for each CPU in need. rcuquiesce clears the CPU's bit,
+// and the CPU that clears the last one runs the callbacks from its
+// scheduler loop, with no locks held.
+//
+// rcu.lock comes before ptable.lock, so call_rcu must not be called
+// with ptable.lock held.
+
+#include "../../user/types.h"
+#include "../defs/defs.h"
+#include "../defs/param.h"
+#include "../arch/x86_32/x86.h"
+#include "../arch/x86_32/mem/memlayout.h"
+#include "../arch/x86_32/mem/mmu.h"
+#include "spinlock.h"
+#include "../sched/proc.h"
+#include "rcu.h"
+
+static struct {
+  struct spinlock lock;
+  struct rcuhead *next;   // waiting for a grace period to start
+  struct rcuhead *wait;   // waiting for the current one to end
+  uint32 need;            // CPUs that have yet to pass through the scheduler
+} rcu;
+
+struct rcusync {
+  struct rcuhead head;
+  int done;
+};
+
+void
+rcuinit(void)
+{
+  initlock(&rcu.lock, "rcu");
+}
+
+// Start a grace period for the callbacks on next, unless there are
+// none or the last batch is still waiting. Caller holds rcu.lock.
+static void
+rcustart(void)
+{
+  if(rcu.wait || rcu.next == 0)
+    return;
+  rcu.wait = rcu.next;
+  rcu.next = 0;
+  __sync_synchronize();
+  rcu.need = (1 << ncpu) - 1;
+}
+
+// Call func(h) once no reader can see what h is part of.
+void
+call_rcu(struct rcuhead *h, void (*func)(struct rcuhead*))
+{
+  h->func = func;
+  acquire(&rcu.lock);
+  h->next = rcu.next;
+  rcu.next = h;
+  rcustart();
+  release(&rcu.lock);
+}
+
+// Called by the scheduler loop of CPU cpu, with no locks held.
+void
+rcuquiesce(int cpu)
+{
+  struct rcuhead *h, *done;
+  uint32 bit = 1 << cpu;
+
+  if((rcu.need & bit) == 0)
+    return;
+  if(__sync_fetch_and_and(&rcu.need, ~bit) != bit)
+    return;
+
+  // That was the last CPU: the grace period is over.
+  acquire(&rcu.lock);
+  done = rcu.wait;
+  rcu.wait = 0;
+  rcustart();
+  release(&rcu.lock);
+  while((h = done) != 0){
+    done = h->next;
+    h->func(h);
+  }
+}
+
+static void
+rcuwake(struct rcuhead *h)
+{
+  struct rcusync *s = rcu_entry(h, struct rcusync, head);
+
+  acquire(&rcu.lock);
+  s->done = 1;
+  wakeup(s);
+  release(&rcu.lock);
+}
+
+// Wait until every reader that might have seen something
+// unpublished before the call is done.
+void
+synchronize_rcu(void)
+{
+  struct rcusync s;
+
+  s.done = 0;
+  call_rcu(&s.head, rcuwake);
+  acquire(&rcu.lock);
+  while(!s.done)
+    sleep(&s, &rcu.lock);
+  release(&rcu.lock);
+}
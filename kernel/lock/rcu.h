@@ -0,0 +1,28 @@
+// Read-copy update, see rcu.c.
+
+#ifndef XV6I386_RCU_H
+#define XV6I386_RCU_H
+
+struct rcuhead {
+  struct rcuhead *next;
+  void (*func)(struct rcuhead*);
+};
+
+// A reader must not sleep or give up the CPU in between.
+#define rcu_read_lock()    pushcli()
+#define rcu_read_unlock()  popcli()
+
+// Load a pointer that a writer publishes with rcu_assign_pointer.
+// x86 keeps dependent loads in order, so only the compiler has to be
+// kept from loading it twice.
+#define rcu_dereference(p)  (*(volatile __typeof__(p) *)&(p))
+
+// Publish v in p, after the stores that set up what it points to.
+#define rcu_assign_pointer(p, v) \
+  do { __sync_synchronize(); (p) = (v); } while(0)
+
+// The structure of type type whose field field is h.
+#define rcu_entry(h, type, field) \
+  ((type*)((char*)(h) - __builtin_offsetof(type, field)))
+
+#endif // XV6I386_RCU_H
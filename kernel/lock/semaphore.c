@@ -1,71 +1,162 @@
 //
-// Created by dustyn on 6/11/24.
+// Counting semaphores.
 //
+// semwait takes one from the count, or joins the end of the semaphore's queue and sleeps
+// until a post reaches it. sempost gives the count straight to the waiter at the head rather
+// than back to the semaphore, so a process that comes along later can't take it first and
+// no waiter is passed over. Each waiter sleeps on its own entry, so a post wakes one.
+//
+// Named semaphores live in a small table and are opened from user space as file
+// descriptors (see sys_semopen). The first open of a name makes it, and it goes away
+// when the last descriptor for it is closed.
+//
+
 #include "../../user/types.h"
 #include "../defs/param.h"
 #include "../arch/x86_32/mem/mmu.h"
 #include "../defs/defs.h"
-#include "../arch/x86_32/x86.h"
 #include "spinlock.h"
 #include "../sched/proc.h"
 #include "semaphore.h"
-static int remove_pid(int pid, struct semaphore *sem);
-//increment semaphore value
-void sem_inc(struct semaphore *sem) {
-    struct proc *this = myproc();
-    sem->sem_value++;
-    sem->holding--;
-    remove_pid(this->pid,sem);
-    if (sem->sem_waiting > 0) {
-        wakeup(sem);
-    }
 
+struct semwaiter {
+    int granted;            // a post handed us the count
+    struct semwaiter *next;
+};
+
+struct {
+    struct spinlock lock;
+    struct semaphore sem[NSEM];
+} semtable;
+
+void
+seminit(void) {
+    initlock(&semtable.lock, "semtable");
 }
-//find a pid in the sem holders array to verify that they are actually there
-static int remove_pid(int pid, struct semaphore *sem) {
-    for (int i = 0; i < MAX_HOLDERS; i++) {
-        if (sem->holder_pids[i] == pid) {
-            sem->holder_pids[i] = 0;
-            return 1;
-        }
+
+void
+initsem(struct semaphore *sem, int value) {
+    initlock(&sem->lock, "sem");
+    sem->value = value;
+    sem->head = 0;
+    sem->tail = &sem->head;
+}
+
+// Give the count to the longest waiter, or back to the semaphore if there is none.
+// Caller holds sem->lock.
+static void
+post1(struct semaphore *sem) {
+    struct semwaiter *w;
+
+    if ((w = sem->head) == 0) {
+        sem->value++;
+        return;
     }
-    return 0;
+    if ((sem->head = w->next) == 0)
+        sem->tail = &sem->head;
+    w->granted = 1;
+    wakeup(w);
 }
-//insert new pid into the holders array
-static int insert_pid(int pid, struct semaphore *sem) {
-    for (int i = 0; i < MAX_HOLDERS; i++) {
-        if (sem->holder_pids[i] == 0) {
-            sem->holder_pids[i] = pid;
-            return 1;
+
+/*
+ * Take one from the count, waiting in line for it if it is zero.
+ * Returns 0, or -1 if the process was killed while it waited.
+ */
+int
+semwait(struct semaphore *sem) {
+    struct semwaiter w, **pw;
+    struct proc *p = myproc();
+
+    acquire(&sem->lock);
+    if (sem->value > 0) {
+        sem->value--;
+        release(&sem->lock);
+        return 0;
+    }
+    w.granted = 0;
+    w.next = 0;
+    *sem->tail = &w;
+    sem->tail = &w.next;
+    while (!w.granted && !p->killed)
+        sleep(&w, &sem->lock);
+    if (p->killed) {
+        if (w.granted) {
+            // it won't be used: pass it on
+            post1(sem);
+        } else {
+            for (pw = &sem->head; *pw != &w; pw = &(*pw)->next)
+                ;
+            if ((*pw = w.next) == 0)
+                sem->tail = pw;
         }
+        release(&sem->lock);
+        return -1;
     }
+    release(&sem->lock);
     return 0;
 }
-//init sem with an initial value passed in , must be at least one and no greater than MAX_SEM_VAL
-int init_sem(struct semaphore *sem, int sem_value) {
-    if (sem_value <= 0 || sem_value > MAX_SEM_VAL) {
-        return -EINVL;
-    }
-    sem->sem_waiting = 0;
-    sem->holding = 0;
-    sem->sem_value = sem_value;
-    for (int i = 0; i < MAX_HOLDERS; i++) {
-        sem->holder_pids[i] = 0;
+
+/*
+ * Take one from the count if that can be done without waiting. Returns 0 if it was, -1 if not.
+ */
+int
+semtrywait(struct semaphore *sem) {
+    int r = -1;
+
+    acquire(&sem->lock);
+    if (sem->value > 0) {
+        sem->value--;
+        r = 0;
     }
-    return 1;
+    release(&sem->lock);
+    return r;
 }
-//decrement the semaphore, sleep if value is 0, otherwise update sem data strcuture accordingly
-int sem_dec(struct semaphore *sem){
-    struct proc *this_p = myproc();
-    acquire(sem->lk);
-    if(sem->sem_value == 0){
-        sleep(sem,sem->lk);
+
+void
+sempost(struct semaphore *sem) {
+    acquire(&sem->lock);
+    post1(sem);
+    release(&sem->lock);
+}
+
+/*
+ * Find the named semaphore called name, or make it with the given value if there is none,
+ * and take a reference to it. Returns 0 if the name is bad or the table is full.
+ */
+struct semaphore *
+semopen(char *name, int value) {
+    struct semaphore *s, *free = 0;
+
+    if (name[0] == 0 || value < 0)
+        return 0;
+    acquire(&semtable.lock);
+    for (s = semtable.sem; s < &semtable.sem[NSEM]; s++) {
+        if (s->ref && strncmp(s->name, name, SEMNAME) == 0) {
+            s->ref++;
+            release(&semtable.lock);
+            return s;
+        }
+        if (s->ref == 0 && free == 0)
+            free = s;
     }
-    if(!insert_pid(this_p->pid,sem)){
-        return -ECANTINSERT;
+    if ((s = free) != 0) {
+        safestrcpy(s->name, name, SEMNAME);
+        initsem(s, value);
+        s->ref = 1;
     }
-    sem->sem_value--;
-    sem->holding++;
-    release(sem->lk);
-    return 0;
-}
\ No newline at end of file
+    release(&semtable.lock);
+    return s;
+}
+
+/*
+ * Drop a reference taken by semopen. The last one frees the name.
+ */
+void
+semclose(struct semaphore *sem) {
+    acquire(&semtable.lock);
+    if (sem->ref < 1)
+        panic("semclose");
+    if (--sem->ref == 0)
+        sem->name[0] = 0;
+    release(&semtable.lock);
+}
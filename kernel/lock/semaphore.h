@@ -4,18 +4,19 @@
 
 #ifndef I386_XV6_REWORK_SEMAPHORE_H
 #define I386_XV6_REWORK_SEMAPHORE_H
-#define EINVL 1
-#define ECANTINSERT 2
-#define MAX_HOLDERS 10 //we'll set an arbitrary max holders
-#define MAX_SEM_VAL 16
-struct semaphore{
-    int sem_value;
-    int sem_waiting; // number waiting on this semaphore, this can be a queue of either exclusive or non-exclusive waiters but now this is fine
-    int holding;
-    int holder_pids[MAX_HOLDERS]; // this will be a way to verify that the process calling sem_inc actually has it and we can see who is holding it
-    struct spinlock *lk;
+#define SEMNAME 16 // bytes in the name of a named semaphore
+
+struct semwaiter;
+
+// Counting semaphore. Waiters queue in the order they came, and a post
+// while someone waits hands the count straight to the one at the head.
+struct semaphore {
+    struct spinlock lock;
+    int value;
+    struct semwaiter *head; // longest waiting first
+    struct semwaiter **tail;
+    // named semaphores only, both protected by the table lock in semaphore.c
+    char name[SEMNAME];
+    int ref;                // open file descriptors
 };
-void sem_inc(struct semaphore *sem);
-int init_sem(struct semaphore *sem, int sem_value);
-int sem_dec(struct semaphore *sem);
 #endif //I386_XV6_REWORK_SEMAPHORE_H
@@ -1,4 +1,9 @@
 // Sleeping locks
+//
+// A sleep lock is held either exclusive, by one process, or shared, by
+// any number of readers (acquiresleepshared). A waiting writer keeps
+// new readers out, so a stream of readers can't starve it. A process
+// must not take a lock shared that it already holds.
 
 #include "../../user/types.h"
 #include "../defs/defs.h"
@@ -10,6 +15,11 @@
 #include "../sched/proc.h"
 #include "sleeplock.h"
 
+// How long acquiresleep spins on a holder that is running on another
+// CPU before it gives up and sleeps. About the cost of the two context
+// switches sleeping would take.
+#define SLEEPSPIN 20000  // TSC cycles
+
 void
 initsleeplock(struct sleeplock *lk, char *name)
 {
@@ -17,26 +27,149 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+  lk->owner = 0;
+  lk->readers = 0;
+  lk->wwait = 0;
+  lk->lsid = lockstatid(name, 1);
 }
 
-void
-acquiresleep(struct sleeplock *lk)
+// Wait for lk to come free without sleeping, for as long as its holder
+// is running on another CPU and no longer than SLEEPSPIN cycles from start.
+// Called without lk->lk; the holder's proc is never freed, so it is
+// safe to look at even if it has let go of the lock by now.
+static void
+spinwait(struct sleeplock *lk, uint64 start)
 {
-  acquire(&lk->lk);
+  struct proc *p;
+
   while (lk->locked) {
-    sleep(lk, &lk->lk);
+    p = lk->owner;
+    if (p == 0 || p->state != RUNNING || rdtsc() - start > SLEEPSPIN)
+      return;
+    pause();
+  }
+}
+
+// Is lk held in a way that keeps us from taking it? Caller holds lk->lk.
+static int
+busy(struct sleeplock *lk, int shared)
+{
+  if (shared)
+    return lk->locked || lk->wwait;
+  return lk->locked || lk->readers;
+}
+
+// Buffer and inode locks are mostly held for a short time by a process
+// that keeps running, so when the holder is on a CPU it is cheaper to
+// spin a little than to sleep and be woken up. A killable wait gives
+// up when the process is killed and returns -1.
+static int
+take(struct sleeplock *lk, int shared, int killable)
+{
+  struct proc *p = myproc();
+  uint64 wait = 0;
+  int spun = 0, spinok = 0;
+
+  acquire(&lk->lk);
+  if (busy(lk, shared)) {
+    wait = rdtsc();
+    if (ncpu > 1 && lk->owner && lk->owner != p && lk->owner->state == RUNNING) {
+      release(&lk->lk);
+      spinwait(lk, wait);
+      acquire(&lk->lk);
+      spun = 1;
+      spinok = !busy(lk, shared);
+    }
+    if (!shared)
+      lk->wwait++;
+    while (busy(lk, shared)) {
+      if (killable && p->killed) {
+        if (!shared && --lk->wwait == 0)
+          wakeup(lk);  // readers we were keeping out
+        release(&lk->lk);
+        return -1;
+      }
+      sleep(lk, &lk->lk);
+    }
+    if (!shared)
+      lk->wwait--;
+    wait = rdtsc() - wait;
+  }
+  if (shared) {
+    lk->readers++;
+  } else {
+    lk->locked = 1;
+    lk->pid = p->pid;
+    lk->owner = p;
+  }
+  if (lk->lsid) {
+    lockstatacquire(lk->lsid, cpuid(), wait);
+    if (spun)
+      lockstatspin(lk->lsid, cpuid(), spinok);
+    if (!shared)
+      lk->acqtime = rdtsc();
   }
-  lk->locked = 1;
-  lk->pid = myproc()->pid;
   release(&lk->lk);
+  return 0;
+}
+
+void
+acquiresleep(struct sleeplock *lk)
+{
+  take(lk, 0, 0);
+}
+
+// Take lk like acquiresleep, for a lock that may be held across a
+// wait of unbounded length. Returns -1 if the process is killed first.
+int
+acquiresleepkillable(struct sleeplock *lk)
+{
+  return take(lk, 0, 1);
+}
+
+// Take lk shared, alongside other readers.
+void
+acquiresleepshared(struct sleeplock *lk)
+{
+  take(lk, 1, 0);
 }
 
 void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
+  if (lk->lsid)
+    lockstatrelease(lk->lsid, cpuid(), rdtsc() - lk->acqtime);
+  lk->locked = 0;
+  lk->pid = 0;
+  lk->owner = 0;
+  wakeup(lk);
+  release(&lk->lk);
+}
+
+void
+releasesleepshared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  if (lk->readers == 0)
+    panic("releasesleepshared");
+  if (--lk->readers == 0)
+    wakeup(lk);
+  release(&lk->lk);
+}
+
+// Turn an exclusive hold of lk into a shared one, letting in
+// the readers that are waiting but no writer in between.
+void
+downgradesleep(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  if (lk->lsid)
+    lockstatrelease(lk->lsid, cpuid(), rdtsc() - lk->acqtime);
   lk->locked = 0;
   lk->pid = 0;
+  lk->owner = 0;
+  lk->readers++;
   wakeup(lk);
   release(&lk->lk);
 }
@@ -1,10 +1,15 @@
 // Long-term locks for processes
 struct sleeplock {
-  uint32 locked;       // Is the lock held?
+  uint32 locked;       // Is the lock held exclusive?
+  uint32 readers;      // How many hold it shared
+  uint32 wwait;        // Writers waiting, who keep new readers out
   struct spinlock lk; // spinlock protecting this sleep lock
   
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+  struct proc *owner; // and the same as a pointer, for acquiresleep's spin
+  int lsid;          // Where lockstat counts it
+  uint64 acqtime;    // TSC when it was taken
 };
 
@@ -9,12 +9,87 @@
 #include "spinlock.h"
 #include "../sched/proc.h"
 
+#define NMCSLOCK 4  // locks initmcslock can set up
+
+static struct mcsnode mcsnodes[NMCSLOCK][NCPU] __attribute__((aligned(64)));
+static int nmcs;
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
-  lk->locked = 0;
+  lk->next = 0;
+  lk->owner = 0;
+  lk->tail = 0;
+  lk->mcs = 0;
   lk->cpu = 0;
+  lk->lsid = lockstatid(name, 0);
+}
+
+// Make lk an MCS lock, for the few locks every CPU fights over.
+// Only called while the kernel boots, on one CPU.
+void
+initmcslock(struct spinlock *lk, char *name)
+{
+  initlock(lk, name);
+  if(nmcs == NMCSLOCK)
+    panic("initmcslock");
+  lk->mcs = mcsnodes[nmcs++];
+}
+
+// Take a ticket and wait for it to come up.
+// Returns how many cycles that took, 0 if the lock was free.
+static uint64
+ticketacquire(struct spinlock *lk)
+{
+  uint64 start;
+  uint32 t;
+
+  t = __sync_fetch_and_add(&lk->next, 1);
+  if(lk->owner == t)
+    return 0;
+  start = rdtsc();
+  while(lk->owner != t)
+    pause();
+  return rdtsc() - start;
+}
+
+// Join the end of the line, and if someone is ahead,
+// wait on our own node until they hand the lock over.
+static uint64
+mcsacquire(struct spinlock *lk, int cpu)
+{
+  struct mcsnode *n, *prev;
+  uint64 start;
+
+  n = &lk->mcs[cpu];
+  n->next = 0;
+  n->wait = 1;
+  prev = __sync_lock_test_and_set(&lk->tail, n);
+  if(prev == 0)
+    return 0;
+  start = rdtsc();
+  prev->next = n;
+  while(n->wait)
+    pause();
+  return rdtsc() - start;
+}
+
+// Hand the lock to the next CPU in line, or leave it free.
+static void
+mcsrelease(struct spinlock *lk, int cpu)
+{
+  struct mcsnode *n;
+
+  n = &lk->mcs[cpu];
+  if(n->next == 0){
+    if(__sync_bool_compare_and_swap(&lk->tail, n, 0))
+      return;
+    // someone is joining the line, wait until they link up
+    while(n->next == 0)
+      pause();
+  }
+  n->next->wait = 0;
 }
 
 // Acquire the lock.
@@ -24,16 +99,21 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  struct cpu *c;
+  uint64 wait;
+
   pushcli(); // disable trap to avoid deadlock.
-  if(holding(lk)){
+  c = mycpu();
+  if(lk->cpu == c){
       cprintf("\nname %s\n",lk->name);
       panic("acquire");
   }
 
-
-  // The xchg is atomic.
-  while(xchg(&lk->locked, 1) != 0)
-    ;
+  // Both take the lock with a locked instruction.
+  if(lk->mcs)
+    wait = mcsacquire(lk, c - cpus);
+  else
+    wait = ticketacquire(lk);
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -41,18 +121,31 @@ acquire(struct spinlock *lk)
   __sync_synchronize();
 
   // Record info about lock acquisition for debugging.
-  lk->cpu = mycpu();
+  lk->cpu = c;
+  if(lk->lsid){
+    lockstatacquire(lk->lsid, c - cpus, wait);
+    lk->acqtime = rdtsc();
+  }
+#ifdef DEBUG
   getcallerpcs(&lk, lk->pcs);
+#endif
 }
 
 // Release the lock.
 void
 release(struct spinlock *lk)
 {
+  int cpu;
+
   if(!holding(lk))
     panic("release");
+  cpu = lk->cpu - cpus;
+  if(lk->lsid)
+    lockstatrelease(lk->lsid, cpu, rdtsc() - lk->acqtime);
 
+#ifdef DEBUG
   lk->pcs[0] = 0;
+#endif
   lk->cpu = 0;
 
   // Tell the C compiler and the processor to not move loads or stores
@@ -62,10 +155,12 @@ release(struct spinlock *lk)
   // stores; __sync_synchronize() tells them both not to.
   __sync_synchronize();
 
-  // Release the lock, equivalent to lk->locked = 0.
-  // This code can't use a C assignment, since it might
-  // not be atomic. A real OS would use C atomics here.
-  asm volatile("movl $0, %0" : "+m" (lk->locked) : );
+  // Only the holder changes a ticket lock's owner, so a
+  // plain store (which x86 keeps in order) passes it on.
+  if(lk->mcs)
+    mcsrelease(lk, cpu);
+  else
+    lk->owner = lk->owner + 1;
 
   popcli();
 }
@@ -89,12 +184,13 @@ getcallerpcs(void *v, uint32 pcs[])
 }
 
 // Check whether this cpu is holding the lock.
+// Only the holder sets cpu to itself, and clears it before letting go.
 int
 holding(struct spinlock *lock)
 {
   int r;
   pushcli();
-  r = lock->locked && lock->cpu == mycpu();
+  r = lock->cpu == mycpu();
   popcli();
   return r;
 }
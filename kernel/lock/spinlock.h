@@ -1,11 +1,32 @@
 // Mutual exclusion lock.
+//
+// Locks are handed out in the order CPUs asked for them. Most are ticket
+// locks: a CPU takes the next ticket and spins until the owner count gets
+// to it. A few hot global locks are MCS locks (see initmcslock), where each
+// waiting CPU spins on a cache line of its own and the holder passes the
+// lock straight to the next in line, so a release does not send every
+// waiter's cache after the lock at once.
+
+// A CPU's place in the line for one MCS lock.
+struct mcsnode {
+  struct mcsnode *volatile next;  // CPU behind this one
+  volatile uint32 wait;           // set until the CPU ahead passes the lock on
+  char pad[56];                   // keep each on its own cache line
+};
+
 struct spinlock {
-  uint32 locked;       // Is the lock held?
+  volatile uint32 next;           // ticket lock: next ticket to hand out
+  volatile uint32 owner;          // ticket lock: ticket that holds the lock
+  struct mcsnode *volatile tail;  // MCS lock: last CPU in line, 0 if free
+  struct mcsnode *mcs;            // MCS lock: a node per CPU, 0 for a ticket lock
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+  int lsid;          // Where lockstat counts it, 0 for nowhere.
+  uint64 acqtime;    // TSC when it was taken.
+#ifdef DEBUG
   uint32 pcs[10];      // The call stack (an array of program counters)
                      // that locked the lock.
+#endif
 };
-
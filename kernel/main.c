@@ -19,6 +19,7 @@ extern char end[]; // first address after kernel loaded from ELF file
 int
 main(void)
 {
+  e820init();      // how much memory there is
   kinit1(end, P2V(4*1024*1024)); // phys page allocator
   kvmalloc();      // kernel page table
   mpinit();        // detect other processors
@@ -29,13 +30,20 @@ main(void)
   consoleinit();   // console hardware
   uartinit();      // serial port
   pinit();         // process table
+  rcuinit();       // read-copy update
+  futexinit();     // futex wait queues
   tvinit();        // trap vectors
   binit();         // buffer cache
-  fileinit();      // file table
+  fileinit();      // file and descriptor tables
+  vmspaceinit();   // address spaces
+  shminit();       // shared memory segments
+  seminit();       // named semaphores
   ideinit();       // disk
   startothers();   // start other processors
-  kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
+  kinit2(P2V(4*1024*1024), P2V(phystop)); // must come after startothers()
+  vdatainit();     // page of kernel data user space can read
   userinit();      // first user process
+  swapinit();      // page out to the swap disk, if there is one
   init_mount_lock(); // init the mount lock
   mpmain();        // finish this processor's setup
 
@@ -57,9 +65,8 @@ mpmain(void)
 {
   cprintf("cpu%d: starting %d\n", cpuid(), cpuid());
   idtinit();       // load idt register
+  sysenterinit();  // fast system call entry
   xchg(&(mycpu()->started), 1); // tell startothers() we're up
-  int pages_used = freemem();
-    cprintf("pages used %d\n",pages_used);
   scheduler();     // start running processes
 }
 
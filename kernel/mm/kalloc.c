@@ -8,6 +8,9 @@
 #include "../arch/x86_32/mem/memlayout.h"
 #include "../arch/x86_32/mem/mmu.h"
 #include "../lock/spinlock.h"
+#include "../arch/x86_32/x86.h"
+#include "memstat.h"
+#include "../data/counters.h"
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
@@ -17,12 +20,29 @@ struct run {
   struct run *next;
 };
 
+// Pages on zeroed are known to be all zero. Idle CPUs move pages
+// from freelist to zeroed (see kzeroidle) so that kalloc_zeroed
+// usually doesn't have to clear a page while someone waits for it.
 struct {
   struct spinlock lock;
   int use_lock;
   struct run *freelist;
+  struct run *zeroed;
+  int nzeroed;
+  int maxzeroed;    // how many kzeroidle keeps, scaled to memory by kinit2
+  uint32 nfree;     // pages on freelist and zeroed
+  uint32 total;     // pages handed to the allocator at boot
+  int low;          // nfree went below SWAPLOW, see kmemlow
 } kmem;
 
+static int havemovnti;
+
+// Pages in use as page tables and as user memory. The code that maps
+// and unmaps them keeps these up to date (countpgtab, countuser), so
+// memstat never has to walk a page table.
+static uint32 npgtab;
+static uint32 nuser;
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
@@ -31,15 +51,36 @@ struct {
 void
 kinit1(void *vstart, void *vend)
 {
-  initlock(&kmem.lock, "kmem");
+  initmcslock(&kmem.lock, "kmem");
   kmem.use_lock = 0;
   freerange(vstart, vend);
 }
 
+static void kinitlarge(void*, void*);
+
+// The usable parts of [vstart, vend) (see e820.c) go on the free list,
+// except for the top NLPAGE 4MB pages which become the large page pool.
 void
 kinit2(void *vstart, void *vend)
 {
-  freerange(vstart, vend);
+  uint32 eax, ebx, ecx, edx;
+  uint32 lo = V2P(vstart), hi = V2P(vend), large, top;
+
+  top = LPGROUNDDOWN(hi);
+  large = top - NLPAGE*LPGSIZE;
+  if(top < lo + NLPAGE*LPGSIZE || !e820usable(large, top))
+    large = top = hi;  // no pool, MAP_HUGE makes do with 4KB pages
+  e820free(lo, large, freerange);
+  e820free(top, hi, freerange);
+  kinitlarge(P2V(large), P2V(top));
+
+  kmem.maxzeroed = kmem.total / 64;
+  if(kmem.maxzeroed < NZEROPAGE)
+    kmem.maxzeroed = NZEROPAGE;
+  cprintf("mem: %d MB usable\n", kmem.total / 256 + (top - large) / (1024*1024));
+
+  readcpuid(1, &eax, &ebx, &ecx, &edx);
+  havemovnti = (edx & CPUID_EDX_SSE2) != 0;
   kmem.use_lock = 1;
 }
 
@@ -48,8 +89,10 @@ freerange(void *vstart, void *vend)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)vend; p += PGSIZE){
+    kmem.total++;
     kfree(p);
+  }
 }
 //PAGEBREAK: 21
 // Free the page of physical memory pointed at by v,
@@ -61,19 +104,24 @@ kfree(char *v)
 {
   struct run *r;
 
-  if((uint64)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+  if((uint64)v % PGSIZE || v < end || V2P(v) >= phystop)
     panic("kfree");
 
+#ifdef DEBUG
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
   if(kmem.use_lock)
     acquire(&kmem.lock);
   r = (struct run*)v;
   r->next = kmem.freelist;
   kmem.freelist = r;
-  if(kmem.use_lock)
+  kmem.nfree++;
+  if(kmem.use_lock){
     release(&kmem.lock);
+    countinc(CNT_KFREE);  // not before seginit has set up %gs
+  }
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -89,8 +137,201 @@ kalloc(void)
   r = kmem.freelist;
   if(r)
     kmem.freelist = r->next;
+  else if((r = kmem.zeroed) != 0){
+    kmem.zeroed = r->next;
+    kmem.nzeroed--;
+  }
+  if(r && --kmem.nfree < SWAPLOW)
+    kmem.low = 1;
+  if(kmem.use_lock){
+    release(&kmem.lock);
+    if(r)
+      countinc(CNT_KALLOC);
+  }
+  return (char*)r;
+}
+
+// Clear a page. Non-temporal stores keep a page nobody is
+// going to read soon from pushing everything else out of the cache.
+static void
+zeropage(char *v)
+{
+  char *p;
+
+  if(!havemovnti){
+    memset(v, 0, PGSIZE);
+    return;
+  }
+  for(p = v; p < v + PGSIZE; p += 16)
+    asm volatile("movnti %1, (%0)\n\t"
+                 "movnti %1, 4(%0)\n\t"
+                 "movnti %1, 8(%0)\n\t"
+                 "movnti %1, 12(%0)" : : "r" (p), "r" (0) : "memory");
+  asm volatile("sfence" : : : "memory");
+}
+
+// Allocate one 4096-byte page of physical memory, filled
+// with zeroes. Takes a page the idle loop already cleared
+// if there is one.
+char*
+kalloc_zeroed(void)
+{
+  struct run *r;
+
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  r = kmem.zeroed;
+  if(r){
+    kmem.zeroed = r->next;
+    kmem.nzeroed--;
+    if(--kmem.nfree < SWAPLOW)
+      kmem.low = 1;
+  }
   if(kmem.use_lock)
     release(&kmem.lock);
+
+  if(r){
+    countinc(CNT_KALLOC);
+    r->next = 0;  // the link was the only non-zero word
+    return (char*)r;
+  }
+  if((r = (struct run*)kalloc()) != 0)
+    memset(r, 0, PGSIZE);
   return (char*)r;
 }
 
+// Called by the scheduler when this CPU has nothing to run.
+// Clears one free page and moves it to the zeroed pool,
+// up to maxzeroed pages.
+void
+kzeroidle(void)
+{
+  struct run *r;
+
+  // the other CPUs get here while kinit2 is still filling freelist without the lock
+  if(!kmem.use_lock)
+    return;
+  acquire(&kmem.lock);
+  r = 0;
+  if(kmem.nzeroed < kmem.maxzeroed && (r = kmem.freelist) != 0)
+    kmem.freelist = r->next;
+  release(&kmem.lock);
+  if(r == 0)
+    return;
+
+  zeropage((char*)r);
+
+  acquire(&kmem.lock);
+  r->next = kmem.zeroed;
+  kmem.zeroed = r;
+  kmem.nzeroed++;
+  release(&kmem.lock);
+}
+
+
+// 4MB pages for large user mappings (MAP_HUGE, see mm/mmap.c) come
+// from a separate pool carved off the top of memory at boot, since
+// the 4KB free list is never contiguous once the system is running.
+// Callers fall back to 4KB pages when the pool is empty.
+struct {
+  struct spinlock lock;
+  struct run *freelist;
+  uint32 nfree;
+  uint32 total;
+} kmemlarge;
+
+// Hand [vstart, vend) to the large page pool, from kinit2.
+static void
+kinitlarge(void *vstart, void *vend)
+{
+  char *p;
+
+  initlock(&kmemlarge.lock, "kmemlarge");
+  p = (char*)LPGROUNDUP((uint32)vstart);
+  for(; p + LPGSIZE <= (char*)vend; p += LPGSIZE){
+    kmemlarge.total++;
+    kfreelarge(p);
+  }
+}
+
+void
+kfreelarge(char *v)
+{
+  struct run *r;
+
+  if((uint32)v % LPGSIZE || v < end || V2P(v) >= phystop)
+    panic("kfreelarge");
+
+  acquire(&kmemlarge.lock);
+  r = (struct run*)v;
+  r->next = kmemlarge.freelist;
+  kmemlarge.freelist = r;
+  kmemlarge.nfree++;
+  release(&kmemlarge.lock);
+}
+
+// Allocate one 4MB, 4MB aligned page of physical memory.
+// Returns 0 if the pool is empty.
+char*
+kalloclarge(void)
+{
+  struct run *r;
+
+  acquire(&kmemlarge.lock);
+  r = kmemlarge.freelist;
+  if(r){
+    kmemlarge.freelist = r->next;
+    kmemlarge.nfree--;
+  }
+  release(&kmemlarge.lock);
+  return (char*)r;
+}
+
+void
+countpgtab(int n)
+{
+  __sync_fetch_and_add(&npgtab, n);
+}
+
+void
+countuser(int n)
+{
+  __sync_fetch_and_add(&nuser, n);
+}
+
+// Number of free 4KB pages, not counting the 4MB pool.
+int
+freemem(void)
+{
+  return kmem.nfree;
+}
+
+// Has kalloc run below SWAPLOW free pages since the last call?
+// kswapd asks every tick.
+int
+kmemlow(void)
+{
+  int low;
+
+  acquire(&kmem.lock);
+  low = kmem.low;
+  kmem.low = 0;
+  release(&kmem.lock);
+  return low;
+}
+
+void
+kmemstat(struct memstat *st)
+{
+  uint32 lpg = LPGSIZE / PGSIZE;
+
+  acquire(&kmem.lock);
+  st->total = kmem.total + kmemlarge.total * lpg;
+  st->free = kmem.nfree + kmemlarge.nfree * lpg;
+  st->zeroed = kmem.nzeroed;
+  release(&kmem.lock);
+  st->pgtab = npgtab;
+  st->user = nuser;
+  st->kernel = st->total - st->free - st->pgtab - st->user;
+  swapstat(st);
+}
@@ -0,0 +1,12 @@
+// Page counters returned by the memstat system call, shared with user space.
+// All counts are in 4096-byte pages.
+struct memstat {
+  uint32 total;    // Pages kalloc manages, the 4MB pool included
+  uint32 free;     // Pages not handed out, zeroed ones included
+  uint32 zeroed;   // Free pages already cleared by the idle loop
+  uint32 pgtab;    // Page directories and page tables
+  uint32 user;     // User memory, shared pages counted once
+  uint32 kernel;   // Everything else: kernel stacks, pipes, segments' bookkeeping...
+  uint32 swapsize; // Slots on the swap disk, 0 if there is none
+  uint32 swapped;  // User pages out on the swap disk
+};
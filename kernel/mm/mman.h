@@ -0,0 +1,12 @@
+// mmap protection and flag bits, shared with user space.
+#define PROT_NONE      0x000
+#define PROT_READ      0x001
+#define PROT_WRITE     0x002
+
+#define MAP_SHARED     0x001   // writes go back to the file on msync / munmap / exit
+#define MAP_PRIVATE    0x002   // writes stay private to this process
+#define MAP_ANONYMOUS  0x004   // zero filled memory, no file behind it
+#define MAP_FIXED      0x008   // map exactly at addr or fail
+#define MAP_HUGE       0x010   // anonymous only, back 4MB aligned chunks with 4MB pages when possible
+
+#define MAP_FAILED     ((void *) -1)
@@ -0,0 +1,713 @@
+//
+// Memory mapped files and anonymous memory.
+//
+// Each address space has a small table of areas (struct vma in proc.h) that live between
+// MMAP_BASE and the stack guard page. mmap() only records the area, pages are filled in
+// the first time they are touched, either from the page fault handler or when a system call
+// argument points into the area (see argptr in syscall.c). MAP_SHARED file pages that have
+// been written (PTE_D) are copied back to the inode by msync, munmap and when the address
+// space goes away.
+//
+// There is no page cache, so MAP_SHARED is shared through the file rather than page by page
+// with other processes. A process sees the file contents as of when it faulted the page in.
+// A forked child gets copies of the parent's private pages, the parent's shared file pages are
+// synced first and the child faults them back in from the file.
+//
+// MAP_HUGE anonymous areas are 4MB aligned, and each whole 4MB chunk is backed by one PTE_PS
+// page from the kalloclarge pool when one is free, or by ordinary 4KB pages when it is not.
+//
+// Shared memory segments (ipc/shm.c) are areas too, they are mapped in full when attached
+// and their pages belong to the segment, so unmapping one only clears the page table.
+// MAP_SHARED | MAP_ANONYMOUS areas get a segment of their own with no name, which a forked
+// child maps as well, so they are no bigger than SHMMAXPAGES and only unmapped whole.
+//
+// Threads share the areas (see mm/vmspace.c). Everything here that looks at or changes them
+// for the current process holds vm->lock.
+//
+
+#include "../../user/types.h"
+#include "../defs/defs.h"
+#include "../defs/param.h"
+#include "../../user/stat.h"
+#include "../arch/x86_32/mem/memlayout.h"
+#include "../arch/x86_32/mem/mmu.h"
+#include "../arch/x86_32/x86.h"
+#include "../lock/spinlock.h"
+#include "../lock/sleeplock.h"
+#include "../sched/proc.h"
+#include "../arch/x86_32/mem/vm.h"
+#include "../fs/fs.h"
+#include "../fs/file.h"
+#include "../ipc/shm.h"
+#include "mman.h"
+#include "vmspace.h"
+
+// Return the area containing addr, or 0.
+static struct vma *
+findvma(struct vmspace *vm, uint32 addr) {
+    struct vma *v;
+
+    for (v = vm->vmas; v < &vm->vmas[NVMA]; v++) {
+        if (v->len && addr >= v->start && addr < v->start + v->len)
+            return v;
+    }
+    return 0;
+}
+
+// Does [start, end) overlap any area of p?
+static int
+vmaoverlap(struct vmspace *vm, uint32 start, uint32 end) {
+    struct vma *v;
+
+    for (v = vm->vmas; v < &vm->vmas[NVMA]; v++) {
+        if (v->len && start < v->start + v->len && v->start < end)
+            return 1;
+    }
+    return 0;
+}
+
+static struct vma *
+vmaalloc(struct vmspace *vm) {
+    struct vma *v;
+
+    for (v = vm->vmas; v < &vm->vmas[NVMA]; v++) {
+        if (v->len == 0)
+            return v;
+    }
+    return 0;
+}
+
+// Pick a free address range of len bytes aligned to align, first fit from MMAP_BASE.
+static uint32
+vmaplace(struct vmspace *vm, uint32 len, uint32 align) {
+    uint32 start;
+    struct vma *v;
+    int moved;
+
+    start = MMAP_BASE;
+    do {
+        moved = 0;
+        for (v = vm->vmas; v < &vm->vmas[NVMA]; v++) {
+            if (v->len && start < v->start + v->len && v->start < start + len) {
+                start = (v->start + v->len + align - 1) & ~(align - 1);
+                moved = 1;
+            }
+        }
+    } while (moved && start + len <= STACK_GUARD && start + len > start);
+
+    if (start + len > STACK_GUARD || start + len < start)
+        return 0;
+    return start;
+}
+
+// Copy the page at va back to the file. Only the part of the page
+// inside the file is written, mmap never grows a file.
+static void
+writepage(struct vma *v, uint32 va, char *mem) {
+    struct inode *ip = v->file->ip;
+    uint32 off, n, i, n1;
+
+    off = v->off + (va - v->start);
+    ilock(ip);
+    n = ip->size > off ? ip->size - off : 0;
+    iunlock(ip);
+    if (n > PGSIZE)
+        n = PGSIZE;
+
+    for (i = 0; i < n; i += n1) {
+        n1 = n - i;
+        if (n1 > MAXWRITEOP)
+            n1 = MAXWRITEOP;
+        begin_op();
+        ilock(ip);
+        writei(ip, mem + i, off + i, n1);
+        iunlock(ip);
+        end_op();
+    }
+}
+
+// Write back the dirty pages of a shared file mapping in [start, end)
+// and mark them clean.
+static void
+syncrange(struct vmspace *vm, struct vma *v, uint32 start, uint32 end) {
+    uint32 va;
+    pte_t *pte;
+
+    if (!(v->flags & MAP_SHARED) || v->file == 0)
+        return;
+
+    for (va = start; va < end; va += PGSIZE) {
+        if ((pte = walkpgdir(vm->pgdir, (void *) va, 0)) == 0)
+            continue;
+        if ((*pte & PTE_P) && (*pte & PTE_D)) {
+            writepage(v, va, P2V(PTE_ADDR(*pte)));
+            *pte &= ~PTE_D;
+        }
+    }
+}
+
+// Write back and free the pages of area v in [start, end).
+static void
+unmaprange(struct vmspace *vm, struct vma *v, uint32 start, uint32 end, struct tlbgather *tg) {
+    uint32 va, pa;
+    pte_t *pte;
+
+    syncrange(vm, v, start, end);
+    for (va = start; va < end; va += PGSIZE) {
+        if ((pte = walkpgdir(vm->pgdir, (void *) va, 0)) == 0)
+            continue;
+        if (pte == &vm->pgdir[PDX(va)]) {
+            // a 4MB page, munmap keeps MAP_HUGE areas 4MB aligned so all of it goes
+            pa = PTE_ADDR(*pte);
+            *pte = 0;
+            tlbgather(tg, pa, 1);
+            countuser(-(LPGSIZE / PGSIZE));
+            vm->rss -= LPGSIZE / PGSIZE;
+            va += LPGSIZE - PGSIZE;
+            continue;
+        }
+        if (*pte & PTE_P) {
+            pa = PTE_ADDR(*pte);
+            *pte = 0;
+            // segment pages belong to the segment (and its counts)
+            if (v->shm == 0) {
+                tlbgather(tg, pa, 0);
+                countuser(-1);
+            }
+            vm->rss--;
+        } else if (*pte & PTE_SWAP) {
+            swapfree(*pte);
+            *pte = 0;
+        }
+    }
+}
+
+// Map all the pages of v's segment into vm, as v->prot allows.
+// Returns -1 if out of memory, with none of them left mapped.
+static int
+mapshm(struct vmspace *vm, struct vma *v) {
+    uint32 va;
+    int perm = PTE_U;
+
+    if (!(v->prot & (PROT_READ | PROT_WRITE)))
+        return 0;
+    if (v->prot & PROT_WRITE)
+        perm |= PTE_W;
+    for (va = v->start; va < v->start + v->len; va += PGSIZE) {
+        if (mappages(vm->pgdir, (void *) va, PGSIZE, V2P(v->shm->pages[(va - v->start) / PGSIZE]), perm) < 0) {
+            unmaprange(vm, v, v->start, va, 0);
+            return -1;
+        }
+        vm->rss++;
+    }
+    return 0;
+}
+
+// Drop area v altogether.
+static void
+vmafree(struct vmspace *vm, struct vma *v, struct tlbgather *tg) {
+    unmaprange(vm, v, v->start, v->start + v->len, tg);
+    if (v->file)
+        fileclose(v->file);
+    if (v->shm)
+        shmput(v->shm);
+    v->file = 0;
+    v->shm = 0;
+    v->len = 0;
+}
+
+// Back the whole 4MB chunk holding va with one zeroed large page.
+// Fails if the chunk sticks out of the area, already has a page
+// table or the large page pool is empty.
+static int
+populatelarge(struct vmspace *vm, struct vma *v, uint32 va) {
+    uint32 base = LPGROUNDDOWN(va);
+    char *mem;
+    int perm;
+
+    if (base < v->start || base + LPGSIZE > v->start + v->len)
+        return -1;
+    if (vm->pgdir[PDX(base)] & PTE_P)
+        return -1;
+    if ((mem = kalloclarge()) == 0)
+        return -1;
+    memset(mem, 0, LPGSIZE);
+
+    perm = PTE_U | PTE_PS;
+    if (v->prot & PROT_WRITE)
+        perm |= PTE_W;
+    vm->pgdir[PDX(base)] = V2P(mem) | perm | PTE_P;
+    countuser(LPGSIZE / PGSIZE);
+    vm->rss += LPGSIZE / PGSIZE;
+    return 0;
+}
+
+// Fill in the page at va from the area's file, or with zeroes.
+// self is passed on to swapreclaim if memory is short.
+static int
+populate(struct vmspace *vm, struct vma *v, uint32 va, int self) {
+    char *mem;
+    int perm;
+
+    if ((v->flags & MAP_HUGE) && populatelarge(vm, v, va) == 0)
+        return 0;
+    if ((mem = kalloc_zeroed()) == 0 && (swapreclaim(self) == 0 || (mem = kalloc_zeroed()) == 0))
+        return -1;
+    if (v->file) {
+        ilock(v->file->ip);
+        // reads past the end of the file leave the rest of the page zeroed
+        readi(v->file->ip, mem, v->off + (va - v->start), PGSIZE);
+        iunlock(v->file->ip);
+    }
+
+    perm = PTE_U;
+    if (v->prot & PROT_WRITE)
+        perm |= PTE_W;
+    if (mappages(vm->pgdir, (void *) va, PGSIZE, V2P(mem), perm) < 0) {
+        kfree(mem);
+        return -1;
+    }
+    countuser(1);
+    vm->rss++;
+    return 0;
+}
+
+/*
+ * Map len bytes of f starting at off (or anonymous memory) into the current process.
+ * Returns the address of the mapping or -1.
+ */
+int
+mmap(uint32 addr, uint32 len, int prot, int flags, struct file *f, uint32 off) {
+    struct vmspace *vm = myproc()->vm;
+    struct vma *v;
+    uint32 align;
+
+    if (len == 0 || off % PGSIZE != 0)
+        return -1;
+    if (!(flags & MAP_SHARED) == !(flags & MAP_PRIVATE))
+        return -1;
+    // large pages are only private
+    if (!(flags & MAP_PRIVATE))
+        flags &= ~MAP_HUGE;
+    len = PGROUNDUP(len);
+
+    if (flags & MAP_ANONYMOUS) {
+        f = 0;
+        off = 0;
+    } else {
+        flags &= ~MAP_HUGE;
+        if (f == 0 || f->type != FD_INODE || f->ip->type != T_FILE)
+            return -1;
+        if ((prot & PROT_READ) && !f->readable)
+            return -1;
+        // writes to a shared mapping end up in the file
+        if ((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+            return -1;
+    }
+
+    if (flags & MAP_HUGE)
+        len = LPGROUNDUP(len);
+    align = (flags & MAP_HUGE) ? LPGSIZE : PGSIZE;
+
+    acquiresleep(&vm->lock);
+    if (flags & MAP_FIXED) {
+        if (addr % align != 0 || addr < MMAP_BASE || addr + len > STACK_GUARD || addr + len < addr)
+            goto bad;
+        if (vmaoverlap(vm, addr, addr + len))
+            goto bad;
+    } else if (addr % align != 0 || addr < MMAP_BASE || addr + len > STACK_GUARD ||
+               addr + len < addr || vmaoverlap(vm, addr, addr + len)) {
+        // the hint is only used if it happens to be free
+        if ((addr = vmaplace(vm, len, align)) == 0)
+            goto bad;
+    }
+
+    if ((v = vmaalloc(vm)) == 0)
+        goto bad;
+    v->start = addr;
+    v->len = len;
+    v->prot = prot;
+    v->flags = flags;
+    v->file = f ? filedup(f) : 0;
+    v->shm = 0;
+    v->off = off;
+    if ((flags & MAP_SHARED) && f == 0) {
+        if ((v->shm = shmalloc(0, len)) == 0 || mapshm(vm, v) < 0) {
+            if (v->shm)
+                shmput(v->shm);
+            v->shm = 0;
+            v->len = 0;
+            goto bad;
+        }
+    }
+    releasesleep(&vm->lock);
+    return addr;
+
+bad:
+    releasesleep(&vm->lock);
+    return -1;
+}
+
+/*
+ * Map all of segment s into the current process, read and write.
+ * The caller's reference to s moves to the area. Returns the address or -1.
+ */
+int
+shmmap(struct shm *s) {
+    struct vmspace *vm = myproc()->vm;
+    struct vma *v;
+    uint32 addr;
+
+    acquiresleep(&vm->lock);
+    if ((v = vmaalloc(vm)) == 0 || (addr = vmaplace(vm, s->size, PGSIZE)) == 0) {
+        releasesleep(&vm->lock);
+        return -1;
+    }
+    v->start = addr;
+    v->len = s->size;
+    v->prot = PROT_READ | PROT_WRITE;
+    v->flags = MAP_SHARED;
+    v->file = 0;
+    v->shm = s;
+    v->off = 0;
+    if (mapshm(vm, v) < 0) {
+        v->shm = 0;
+        v->len = 0;
+        releasesleep(&vm->lock);
+        return -1;
+    }
+    releasesleep(&vm->lock);
+    return addr;
+}
+
+/*
+ * Detach the segment mapped at addr from the current process.
+ */
+int
+shmunmap(uint32 addr) {
+    struct vmspace *vm = myproc()->vm;
+    struct vma *v;
+    struct tlbgather tg;
+    int r;
+
+    acquiresleep(&vm->lock);
+    // other threads' system calls may be using the segment, wait for them to be done
+    do {
+        if ((v = findvma(vm, addr)) == 0 || v->shm == 0 || (v->flags & MAP_ANONYMOUS) || v->start != addr) {
+            releasesleep(&vm->lock);
+            return -1;
+        }
+    } while ((r = vmunmapstart(vm, v->start, v->start + v->len)) > 0);
+    if (r < 0) {
+        releasesleep(&vm->lock);
+        return -1;
+    }
+    tlbgatherinit(&tg, vm);
+    vmafree(vm, v, &tg);
+    tlbgatherflush(&tg);
+    vmunmapdone(vm);
+    releasesleep(&vm->lock);
+    return 0;
+}
+
+/*
+ * Unmap [addr, addr+len) from the current process, writing back shared file pages first.
+ * The range may cover several areas or part of one, an area split in the middle becomes two.
+ */
+int
+munmap(uint32 addr, uint32 len) {
+    struct vmspace *vm = myproc()->vm;
+    struct vma *v, *tail;
+    uint32 start, end, vend;
+    struct tlbgather tg;
+    int r;
+
+    if (addr % PGSIZE != 0 || len == 0 || addr + len < addr)
+        return -1;
+    acquiresleep(&vm->lock);
+    // other threads' system calls may be using the range, wait for them to be done; the
+    // lock is let go meanwhile, so the areas are looked at only afterwards
+    while ((r = vmunmapstart(vm, addr, PGROUNDUP(addr + len))) > 0)
+        ;
+    if (r < 0)
+        goto bad;
+    // segments are detached whole with shmdetach, shared anonymous areas are unmapped
+    // whole, and 4MB pages are never split
+    for (v = vm->vmas; v < &vm->vmas[NVMA]; v++) {
+        if (v->len == 0 || PGROUNDUP(addr + len) <= v->start || addr >= v->start + v->len)
+            continue;
+        if (v->shm && (!(v->flags & MAP_ANONYMOUS) || addr > v->start || PGROUNDUP(addr + len) < v->start + v->len))
+            goto bad;
+        if (v->flags & MAP_HUGE) {
+            start = addr > v->start ? addr : v->start;
+            end = PGROUNDUP(addr + len) < v->start + v->len ? PGROUNDUP(addr + len) : v->start + v->len;
+            if (start % LPGSIZE != 0 || end % LPGSIZE != 0)
+                goto bad;
+        }
+    }
+
+    // pages are freed only once no TLB can reach them any more
+    tlbgatherinit(&tg, vm);
+    for (v = vm->vmas; v < &vm->vmas[NVMA]; v++) {
+        if (v->len == 0 || PGROUNDUP(addr + len) <= v->start || addr >= v->start + v->len)
+            continue;
+        vend = v->start + v->len;
+        start = addr > v->start ? addr : v->start;
+        end = PGROUNDUP(addr + len) < vend ? PGROUNDUP(addr + len) : vend;
+
+        if (start > v->start && end < vend) {
+            // punching a hole, the part above it gets its own slot
+            if ((tail = vmaalloc(vm)) == 0) {
+                // what was unmapped so far stays unmapped
+                tlbgatherflush(&tg);
+                goto bad;
+            }
+            *tail = *v;
+            tail->start = end;
+            tail->len = vend - end;
+            tail->off = v->off + (end - v->start);
+            if (tail->file)
+                filedup(tail->file);
+        }
+
+        if (start == v->start && end == vend) {
+            vmafree(vm, v, &tg);
+            continue;
+        }
+        unmaprange(vm, v, start, end, &tg);
+        if (start == v->start) {
+            v->off += end - v->start;
+            v->len = vend - end;
+            v->start = end;
+        } else {
+            v->len = start - v->start;
+        }
+    }
+    tlbgatherflush(&tg);
+    vmunmapdone(vm);
+    releasesleep(&vm->lock);
+    return 0;
+
+bad:
+    vmunmapdone(vm);
+    releasesleep(&vm->lock);
+    return -1;
+}
+
+/*
+ * Write back the dirty pages of shared file mappings in [addr, addr+len).
+ */
+int
+msync(uint32 addr, uint32 len) {
+    struct vmspace *vm = myproc()->vm;
+    struct vma *v;
+    uint32 start, end;
+
+    if (addr % PGSIZE != 0)
+        return -1;
+    end = PGROUNDUP(addr + len);
+    if (end < addr)
+        return -1;
+
+    acquiresleep(&vm->lock);
+    for (v = vm->vmas; v < &vm->vmas[NVMA]; v++) {
+        if (v->len == 0 || end <= v->start || addr >= v->start + v->len)
+            continue;
+        start = addr > v->start ? addr : v->start;
+        syncrange(vm, v, start, end < v->start + v->len ? end : v->start + v->len);
+    }
+    tlbflush(vm);  // the cleared dirty bits must not linger in the TLBs
+    releasesleep(&vm->lock);
+    return 0;
+}
+
+/*
+ * Called from the page fault handler. Fill in the page of the current process holding addr
+ * if it belongs to one of its areas and the access is allowed.
+ * Returns 0 if the fault was handled, -1 otherwise.
+ */
+int
+mmapfault(uint32 addr, int write) {
+    struct vmspace *vm = myproc()->vm;
+    struct vma *v;
+    pte_t *pte;
+    int r = -1;
+
+    acquiresleep(&vm->lock);
+    if ((v = findvma(vm, addr)) == 0)
+        goto out;
+    if (write && !(v->prot & PROT_WRITE))
+        goto out;
+    if (!write && !(v->prot & (PROT_READ | PROT_WRITE)))
+        goto out;
+
+    // another thread may have filled it in while we waited for the lock
+    addr = PGROUNDDOWN(addr);
+    if ((pte = walkpgdir(vm->pgdir, (void *) addr, 0)) != 0 && (*pte & PTE_P))
+        r = 0;
+    else
+        r = populate(vm, v, addr, 1);
+out:
+    releasesleep(&vm->lock);
+    return r;
+}
+
+/*
+ * Is [addr, addr+n) inside one area of vm that allows the access? Used to check system call
+ * arguments, the pages are filled in here so the kernel never faults on them.
+ */
+int
+mmapvalid(struct vmspace *vm, uint32 addr, uint32 n, int write) {
+    struct vma *v;
+    uint32 va;
+    pte_t *pte;
+    int ok = 0;
+
+    acquiresleep(&vm->lock);
+    if ((v = findvma(vm, addr)) == 0)
+        goto out;
+    if (addr + n < addr || addr + n > v->start + v->len)
+        goto out;
+    if (write ? !(v->prot & PROT_WRITE) : !(v->prot & (PROT_READ | PROT_WRITE)))
+        goto out;
+
+    if (swapinrange(vm, addr, n) < 0)
+        goto out;
+    for (va = PGROUNDDOWN(addr); va < addr + n; va += PGSIZE) {
+        if ((pte = walkpgdir(vm->pgdir, (void *) va, 0)) != 0 && (*pte & PTE_P))
+            continue;
+        // don't let making room take the pages checked so far
+        if (populate(vm, v, va, 0) < 0)
+            goto out;
+    }
+    ok = 1;
+out:
+    releasesleep(&vm->lock);
+    return ok;
+}
+
+/*
+ * May the page of vm at va go out to swap? Anything but shared memory, MAP_SHARED file pages
+ * and MAP_HUGE areas may (see mm/swap.c). Pages outside any area are heap or stack.
+ */
+int
+mmapswappable(struct vmspace *vm, uint32 va) {
+    struct vma *v;
+
+    if ((v = findvma(vm, va)) == 0)
+        return 1;
+    return v->shm == 0 && !(v->flags & (MAP_SHARED | MAP_HUGE));
+}
+
+/*
+ * Return the end of the area holding addr, or 0 if addr is not mapped.
+ */
+uint32
+mmapend(struct vmspace *vm, uint32 addr) {
+    struct vma *v;
+
+    if ((v = findvma(vm, addr)) == 0)
+        return 0;
+    return v->start + v->len;
+}
+
+// Copy the parent's 4MB page at va into the child, as a 4MB
+// page if the pool has one or as 4KB pages if not.
+static int
+forklarge(struct vmspace *nvm, uint32 va, pte_t *pde) {
+    char *mem, *src = P2V(PTE_ADDR(*pde));
+    uint32 i;
+
+    if ((mem = kalloclarge()) != 0) {
+        memmove(mem, src, LPGSIZE);
+        nvm->pgdir[PDX(va)] = V2P(mem) | PTE_FLAGS(*pde);
+        countuser(LPGSIZE / PGSIZE);
+        nvm->rss += LPGSIZE / PGSIZE;
+        return 0;
+    }
+    for (i = 0; i < LPGSIZE; i += PGSIZE) {
+        if ((mem = kalloc()) == 0)
+            return -1;
+        memmove(mem, src + i, PGSIZE);
+        if (mappages(nvm->pgdir, (void *) (va + i), PGSIZE, V2P(mem), PTE_FLAGS(*pde) & ~PTE_PS) < 0) {
+            kfree(mem);
+            return -1;
+        }
+        countuser(1);
+        nvm->rss++;
+    }
+    return 0;
+}
+
+/*
+ * Give the child's address space nvm the areas of the parent's vm, whose lock the caller holds. Private pages that are already there are copied,
+ * shared file pages are written back and the child faults them in again from the file.
+ * Returns 0 on success, -1 if out of memory.
+ */
+int
+mmapfork(struct vmspace *nvm, struct vmspace *vm) {
+    struct vma *v, *nv;
+    uint32 va, flags;
+    pte_t *pte;
+    char *mem;
+
+    for (v = vm->vmas, nv = nvm->vmas; v < &vm->vmas[NVMA]; v++, nv++) {
+        *nv = *v;
+        if (v->len == 0)
+            continue;
+        if (v->file)
+            filedup(v->file);
+
+        if (v->shm) {
+            shmdup(v->shm);
+            if (mapshm(nvm, nv) < 0)
+                return -1;
+            continue;
+        }
+        if (v->flags & MAP_SHARED) {
+            syncrange(vm, v, v->start, v->start + v->len);
+            continue;
+        }
+        for (va = v->start; va < v->start + v->len; va += PGSIZE) {
+            if ((pte = walkpgdir(vm->pgdir, (void *) va, 0)) == 0 || !(*pte & (PTE_P | PTE_SWAP)))
+                continue;
+            if (pte == &vm->pgdir[PDX(va)]) {
+                if (forklarge(nvm, va, pte) < 0)
+                    return -1;
+                va += LPGSIZE - PGSIZE;
+                continue;
+            }
+            if ((mem = kalloc()) == 0)
+                return -1;
+            flags = PTE_FLAGS(*pte);
+            if (flags & PTE_SWAP) {
+                swapcopy(*pte, mem);
+                flags = (flags & ~PTE_SWAP) | PTE_P;
+            } else {
+                memmove(mem, P2V(PTE_ADDR(*pte)), PGSIZE);
+            }
+            if (mappages(nvm->pgdir, (void *) va, PGSIZE, V2P(mem), flags) < 0) {
+                kfree(mem);
+                return -1;
+            }
+            countuser(1);
+            nvm->rss++;
+        }
+    }
+    tlbflush(vm);  // syncrange cleared dirty bits
+    return 0;
+}
+
+/*
+ * Drop all of vm's areas, when its last thread exits or execs. Shared file pages are written back.
+ * No other thread can reach vm any more, so pages are freed as they go.
+ */
+void
+munmapall(struct vmspace *vm) {
+    struct vma *v;
+
+    for (v = vm->vmas; v < &vm->vmas[NVMA]; v++) {
+        if (v->len)
+            vmafree(vm, v, 0);
+    }
+}
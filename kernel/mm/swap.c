@@ -0,0 +1,323 @@
+//
+// Paging user memory out to a swap disk.
+//
+// If ideinit finds a disk on ata1 slave (SWAPDEV), its first NSWAPSLOT pages are swap slots.
+// A page that is out on the disk has a page table entry with PTE_P clear, PTE_SWAP set and the
+// slot number where the physical address would be. Its PTE_W and PTE_U bits are kept. Touching
+// the page faults, and the fault handler calls swapin to bring it back.
+//
+// kalloc notes when the free list drops below SWAPLOW. kswapd, a kernel process that looks
+// every tick, then pages out until SWAPHIGH pages are free again. Code that may sleep and finds
+// kalloc empty calls swapreclaim to do the same on the spot.
+//
+// Pages are picked clock style. The hand sweeps the user pages of each process in turn. A page
+// that was used since the hand last came by (PTE_A) has the bit cleared and is passed over this
+// time. Only heap, stack and private mmap pages are taken; shared memory segments, MAP_SHARED
+// file pages and 4MB pages stay put.
+//
+// A process only loses pages while it waits to run in user space, or while it is the one asking
+// for memory and has said its own pages may go. So the kernel never finds a page gone while it
+// holds a spinlock. System call arguments are brought back in when they are checked (see
+// validuaddr in syscall.c) and are not taken again before the call returns.
+//
+
+#include "../../user/types.h"
+#include "../defs/defs.h"
+#include "../defs/param.h"
+#include "../arch/x86_32/mem/memlayout.h"
+#include "../arch/x86_32/mem/mmu.h"
+#include "../arch/x86_32/x86.h"
+#include "../lock/spinlock.h"
+#include "../lock/sleeplock.h"
+#include "../sched/proc.h"
+#include "vmspace.h"
+#include "../arch/x86_32/mem/vm.h"
+#include "../fs/fs.h"
+#include "../fs/buf.h"
+#include "../drivers/ide.h"
+#include "memstat.h"
+#include "vdata.h"
+
+#define SWAPBATCH 32  // pages swapreclaim pushes out per call
+
+struct {
+    struct spinlock lock;    // protects used and nused
+    int enabled;
+    uint32 nused;
+    uint8 used[NSWAPSLOT];
+    struct buf buf;          // one page moves at a time, in the order its lock is taken
+    int hand;                // clock hand: a ptable slot
+    uint32 handva;           // and the next address to look at in it
+} swap;
+
+static void kswapd(void);
+
+void
+swapinit(void) {
+    initlock(&swap.lock, "swap");
+    initsleeplock(&swap.buf.lock, "swapbuf");
+    if (!(disk_query() & DEV4))
+        return;
+    swap.enabled = 1;
+    if (kproc("kswapd", kswapd) < 0)
+        panic("swapinit");
+    cprintf("swap: %d pages on dev %d\n", NSWAPSLOT, SWAPDEV);
+}
+
+static int
+slotalloc(void) {
+    int i;
+
+    acquire(&swap.lock);
+    for (i = 0; i < NSWAPSLOT; i++) {
+        if (!swap.used[i]) {
+            swap.used[i] = 1;
+            swap.nused++;
+            release(&swap.lock);
+            return i;
+        }
+    }
+    release(&swap.lock);
+    return -1;
+}
+
+static void
+slotfree(uint32 slot) {
+    acquire(&swap.lock);
+    if (slot >= NSWAPSLOT || !swap.used[slot])
+        panic("slotfree");
+    swap.used[slot] = 0;
+    swap.nused--;
+    release(&swap.lock);
+}
+
+// Write the page at mem to slot, or read it back. Caller holds swap.buf.lock.
+static void
+swapio(uint32 slot, char *mem, int write) {
+    struct buf *b = &swap.buf;
+    int i;
+
+    for (i = 0; i < PGSIZE / BSIZE; i++) {
+        b->dev = SWAPDEV;
+        b->blockno = slot * (PGSIZE / BSIZE) + i;
+        if (write) {
+            memmove(b->data, mem + i * BSIZE, BSIZE);
+            b->flags = B_DIRTY;
+        } else {
+            b->flags = 0;
+        }
+        iderw(b, SWAPDEV);
+        if (!write)
+            memmove(mem + i * BSIZE, b->data, BSIZE);
+    }
+}
+
+// May p's pages be taken now? Caller holds ptable.lock. Threads sharing an address space
+// may be running on other CPUs, so their pages stay put.
+static int
+evictable(struct proc *p, int self) {
+    if (p->vm == 0 || p->vm->sz == 0 || p->vm->ref > 1)
+        return 0;
+    if (p == myproc())
+        return self;
+    return (p->state == RUNNABLE || p->state == PREEMPTED) && p->space_flag == USER_PROC;
+}
+
+// Move the clock hand to the next page worth taking and return its page table entry,
+// or 0 if a couple of sweeps found nothing. Sets *pp to the owner. Caller holds ptable.lock.
+static pte_t *
+clockscan(struct proc **pp, int self) {
+    struct proc *p;
+    pmde_t *pde;
+    pte_t *pte;
+    uint32 va;
+    int n;
+
+    // a page whose accessed bit was cleared on the way past is taken on the next sweep
+    for (n = 0; n <= 2 * NPROC; n++) {
+        p = &ptable.proc[swap.hand];
+        for (va = swap.handva; evictable(p, self) && va < VDATA; va += PGSIZE) {
+            pde = &p->vm->pgdir[PDX(va)];
+            if (!(*pde & PTE_P) || (*pde & PTE_PS)) {
+                va = PGADDR(PDX(va) + 1, 0, 0) - PGSIZE;
+                continue;
+            }
+            pte = &((pte_t *) P2V(PTE_ADDR(*pde)))[PTX(va)];
+            if ((*pte & (PTE_P | PTE_U)) != (PTE_P | PTE_U) || !mmapswappable(p->vm, va))
+                continue;
+            if (*pte & PTE_A) {
+                *pte &= ~PTE_A;
+                p->vm->tlbcpu = 0;  // so the CPU sets it again when the page is used
+                continue;
+            }
+            swap.handva = va + PGSIZE;
+            *pp = p;
+            return pte;
+        }
+        swap.hand = (swap.hand + 1) % NPROC;
+        swap.handva = 0;
+    }
+    return 0;
+}
+
+// Push one page out to the swap disk. self allows the caller's own pages to be taken.
+// Returns 0, or -1 if there is no free slot or nothing to take.
+static int
+swapout(int self) {
+    struct proc *p;
+    pte_t *pte;
+    uint32 pa;
+    int slot;
+
+    acquiresleep(&swap.buf.lock);
+    if ((slot = slotalloc()) < 0) {
+        releasesleep(&swap.buf.lock);
+        return -1;
+    }
+    acquire(&ptable.lock);
+    if ((pte = clockscan(&p, self)) == 0) {
+        release(&ptable.lock);
+        slotfree(slot);
+        releasesleep(&swap.buf.lock);
+        return -1;
+    }
+    pa = PTE_ADDR(*pte);
+    *pte = ((uint32) slot << PTXSHIFT) | PTE_SWAP | (*pte & (PTE_W | PTE_U));
+    p->vm->rss--;
+    p->vm->tlbcpu = 0;  // switchuvm reloads CR3 before p runs again
+    if (p == myproc())
+        lcr3(V2P(p->vm->pgdir));
+    release(&ptable.lock);
+
+    // The page is gone from p's view. If p faults on it, swapin waits for
+    // swap.buf.lock and so for this write.
+    swapio(slot, P2V(pa), 1);
+    releasesleep(&swap.buf.lock);
+    kfree(P2V(pa));
+    countuser(-1);
+    return 0;
+}
+
+// Kernel process started by swapinit. Wakes up every tick and, if kalloc
+// ran low since the last look, pages out until SWAPHIGH pages are free.
+static void
+kswapd(void) {
+    for (;;) {
+        acquire(&tickslock);
+        sleep(&ticks, &tickslock);
+        release(&tickslock);
+        if (!kmemlow())
+            continue;
+        while (freemem() < SWAPHIGH && swapout(0) == 0)
+            ;
+    }
+}
+
+/*
+ * Page out a batch of pages for a caller that found kalloc empty and may sleep. self allows
+ * the caller's own pages to go, which is only safe if it is not going to check a user buffer
+ * and then copy it with a spinlock held. Returns the number of pages freed.
+ */
+int
+swapreclaim(int self) {
+    int n;
+
+    if (!swap.enabled)
+        return 0;
+    for (n = 0; n < SWAPBATCH && swapout(self) == 0; n++)
+        ;
+    return n;
+}
+
+/*
+ * Bring back the page at va of vm (the current process's address space) if it is out on
+ * the swap disk. Returns 1 if it was, 0 if there was nothing to do and -1 if out of memory.
+ */
+int
+swapin(struct vmspace *vm, uint32 va, int self) {
+    pte_t *pte;
+    char *mem;
+    uint32 slot;
+
+    if ((pte = walkpgdir(vm->pgdir, (void *) PGROUNDDOWN(va), 0)) == 0 || !(*pte & PTE_SWAP))
+        return 0;
+    if ((mem = kalloc()) == 0 && (swapreclaim(self) == 0 || (mem = kalloc()) == 0))
+        return -1;
+
+    acquiresleep(&swap.buf.lock);
+    if (!(*pte & PTE_SWAP)) {
+        // another thread of vm faulted on the same page and brought it in first
+        releasesleep(&swap.buf.lock);
+        kfree(mem);
+        return 1;
+    }
+    slot = PTE_ADDR(*pte) >> PTXSHIFT;
+    swapio(slot, mem, 0);
+    *pte = V2P(mem) | (PTE_FLAGS(*pte) & ~PTE_SWAP) | PTE_P;
+    vm->rss++;
+    releasesleep(&swap.buf.lock);
+    slotfree(slot);
+    countuser(1);
+    return 1;
+}
+
+/*
+ * Bring back every page of [addr, addr+n) of vm that is out on the swap disk, so the kernel
+ * can use the range without faulting. Returns 0, or -1 if out of memory.
+ */
+int
+swapinrange(struct vmspace *vm, uint32 addr, uint32 n) {
+    uint32 va;
+
+    if (swap.nused == 0)
+        return 0;
+    for (va = PGROUNDDOWN(addr); va < addr + n; va += PGSIZE) {
+        if (swapin(vm, va, 0) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * Read the page a swapped out page table entry refers to into mem, for fork.
+ */
+void
+swapcopy(uint32 pte, char *mem) {
+    acquiresleep(&swap.buf.lock);
+    swapio(PTE_ADDR(pte) >> PTXSHIFT, mem, 0);
+    releasesleep(&swap.buf.lock);
+}
+
+/*
+ * Give back the slot of a swapped out page table entry, when the page is unmapped.
+ */
+void
+swapfree(uint32 pte) {
+    slotfree(PTE_ADDR(pte) >> PTXSHIFT);
+}
+
+/*
+ * Count the pages of [start, end) that are out on the swap disk.
+ */
+int
+swapcount(pmde_t *pgdir, uint32 start, uint32 end) {
+    pte_t *pte;
+    uint32 va;
+    int n = 0;
+
+    if (swap.nused == 0)
+        return 0;
+    for (va = PGROUNDUP(start); va < end; va += PGSIZE) {
+        if ((pte = walkpgdir(pgdir, (void *) va, 0)) == 0)
+            va = PGADDR(PDX(va) + 1, 0, 0) - PGSIZE;
+        else if (pte != &pgdir[PDX(va)] && (*pte & PTE_SWAP))
+            n++;
+    }
+    return n;
+}
+
+void
+swapstat(struct memstat *st) {
+    st->swapsize = swap.enabled ? NSWAPSLOT : 0;
+    st->swapped = swap.nused;
+}
@@ -0,0 +1,159 @@
+//
+// Read-only pages of kernel data mapped into every process (see vdata.h), so
+// that uptime(), getpid() and a nanosecond clock need no trip into the kernel.
+//
+// The clock runs on the TSC. vdatainit measures its rate against PIT channel
+// 2 at boot. Every tick, the timer interrupt adds the cycles since the last
+// tick to vdata.ns. User code adds the cycles since then itself, so the clock
+// only moves forward. The TSC is assumed to run at the same rate and to be in
+// step on all CPUs, which holds on anything with an invariant TSC and on QEMU.
+//
+
+#include "../../user/types.h"
+#include "../defs/defs.h"
+#include "../defs/param.h"
+#include "../arch/x86_32/mem/memlayout.h"
+#include "../arch/x86_32/mem/mmu.h"
+#include "../arch/x86_32/x86.h"
+#include "../arch/x86_32/mem/vm.h"
+#include "vdata.h"
+
+#define PIT_HZ    1193182  // PIT input clock
+#define PIT_CH2   0x42     // channel 2 counter
+#define PIT_MODE  0x43
+#define PIT_PORTB 0x61     // bit 0 gates channel 2, bit 1 drives the speaker, bit 5 is channel 2 output
+#define CALMS     10       // calibrate over this many milliseconds
+
+static struct vdata *vdata;
+
+// 64 by 32 bit division. The kernel is not linked with libgcc, which
+// is where the compiler would go for one.
+static uint64
+div64(uint64 n, uint32 d) {
+    uint64 q = 0, r = 0;
+    int i;
+
+    for (i = 63; i >= 0; i--) {
+        r = (r << 1) | ((n >> i) & 1);
+        if (r >= d) {
+            r -= d;
+            q |= (uint64) 1 << i;
+        }
+    }
+    return q;
+}
+
+// Count TSC cycles while PIT channel 2 counts down CALMS milliseconds.
+// Returns the TSC rate in kHz, or 0 if the PIT never finished.
+static uint32
+tsccalibrate(void) {
+    uint32 count = PIT_HZ / 1000 * CALMS, i;
+    uint64 start;
+
+    outb(PIT_PORTB, (inb(PIT_PORTB) & ~0x02) | 0x01);
+    outb(PIT_MODE, 0xB0);  // channel 2, low then high byte, mode 0: output goes high at zero
+    outb(PIT_CH2, count & 0xff);
+    outb(PIT_CH2, count >> 8);
+    start = rdtsc();
+    for (i = 0; !(inb(PIT_PORTB) & 0x20); i++) {
+        if (i == 10000000)
+            return 0;
+    }
+    return (uint32) (rdtsc() - start) / CALMS;
+}
+
+// Nanoseconds for a number of TSC cycles, in pieces
+// small enough for the product not to overflow.
+static uint64
+cyc2ns(uint64 cycles) {
+    uint64 ns = 0;
+
+    for (; cycles > 0xffffffff; cycles -= 0xffffffff)
+        ns += ((uint64) 0xffffffff * vdata->mult) >> VDATA_SHIFT;
+    return ns + ((cycles * vdata->mult) >> VDATA_SHIFT);
+}
+
+/*
+ * Set up the shared page and calibrate the TSC. Runs once on the boot CPU, with interrupts
+ * off, before the first process is made.
+ */
+void
+vdatainit(void) {
+    uint64 mult;
+
+    if ((vdata = (struct vdata *) kalloc_zeroed()) == 0)
+        panic("vdatainit");
+    vdata->tsckhz = tsccalibrate();
+    if (vdata->tsckhz != 0) {
+        mult = div64((uint64) 1000000 << VDATA_SHIFT, vdata->tsckhz);
+        if (mult > 0xffffffff)
+            vdata->tsckhz = 0;  // too slow to be a TSC worth using
+        else
+            vdata->mult = mult;
+    }
+    vdata->tsc = rdtsc();
+    cprintf("tsc: %d kHz\n", vdata->tsckhz);
+}
+
+/*
+ * Called from the timer interrupt on CPU 0 with tickslock held, after ticks moved on.
+ * seq tells readers to try again if they raced with this.
+ */
+void
+vdatatick(uint32 t) {
+    uint64 now = rdtsc();
+
+    vdata->seq++;
+    __sync_synchronize();
+    vdata->ticks = t;
+    vdata->ns += cyc2ns(now - vdata->tsc);
+    vdata->tsc = now;
+    __sync_synchronize();
+    vdata->seq++;
+}
+
+/*
+ * Map the shared page and a fresh page holding pid into a new address space. On failure,
+ * freevm cleans up whatever was mapped. Returns 0, or -1 if out of memory.
+ */
+int
+vdatamap(pmde_t *pgdir, int pid) {
+    char *mem;
+
+    if ((mem = kalloc_zeroed()) == 0)
+        return -1;
+    ((struct vproc *) mem)->pid = pid;
+    if (mappages(pgdir, (void *) VPROC, PGSIZE, V2P(mem), PTE_U) < 0) {
+        kfree(mem);
+        return -1;
+    }
+    return mappages(pgdir, (void *) VDATA, PGSIZE, V2P(vdata), PTE_U);
+}
+
+/*
+ * Mark the VPROC page of an address space as shared by threads, before clone
+ * gives it a second one: from then on pid may not be the reader's.
+ */
+void
+vdatathreaded(pmde_t *pgdir) {
+    pte_t *pte;
+
+    if ((pte = walkpgdir(pgdir, (void *) VPROC, 0)) != 0 && (*pte & PTE_P))
+        ((struct vproc *) P2V(PTE_ADDR(*pte)))->threaded = 1;
+}
+
+/*
+ * Take the pages out of an address space that is being freed, so that deallocuvm
+ * does not free the shared one.
+ */
+void
+vdataunmap(pmde_t *pgdir) {
+    pte_t *pte;
+
+    if ((pte = walkpgdir(pgdir, (void *) VPROC, 0)) != 0 && (*pte & PTE_P)) {
+        kfree(P2V(PTE_ADDR(*pte)));
+        *pte = 0;
+    }
+    if ((pte = walkpgdir(pgdir, (void *) VDATA, 0)) != 0)
+        *pte = 0;
+}
@@ -0,0 +1,26 @@
+// Kernel data every process can read without a system call, shared with
+// user space (see ulib.c). Both pages sit just below KERNBASE, above the
+// stack, and are mapped read-only by exec, fork and userinit.
+//
+// VDATA is one page shared by all processes, updated on every timer tick.
+// VPROC is a page of each process's own, written when it is mapped. Threads
+// share it with the process that cloned them, which sets threaded first.
+
+#define VDATA 0x7FFFE000
+#define VPROC 0x7FFFF000
+
+#define VDATA_SHIFT 24  // vdata.mult is nanoseconds per TSC cycle, times 2^VDATA_SHIFT
+
+struct vdata {
+  uint32 seq;      // odd while the kernel is updating the fields below
+  uint32 ticks;    // what uptime() returns
+  uint32 tsckhz;   // TSC cycles per millisecond, 0 if calibration failed
+  uint32 mult;     // nanoseconds per TSC cycle, scaled by 2^VDATA_SHIFT
+  uint64 tsc;      // TSC at the last tick
+  uint64 ns;       // nanoseconds since boot at the last tick
+};
+
+struct vproc {
+  int pid;
+  int threaded;    // the page is shared by threads, pid is not theirs
+};
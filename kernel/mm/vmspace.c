@@ -0,0 +1,234 @@
+//
+// Address spaces.
+//
+// Every process has one (struct vmspace), holding its page table, the sizes of its heap and
+// stack and its mmap areas. fork makes a copy, clone takes another reference to the same one,
+// which is what makes the new process a thread. The last thread to let go frees the mappings
+// and the page table.
+//
+// Threads change the shared mappings with vm->lock held: sbrk, stack growth, mmap and munmap,
+// and filling in mmap pages on a fault. Page tables of an address space with more than one
+// thread may be loaded on several CPUs at once, so a mapping taken away has to be flushed from
+// all of them (tlbflush in vm.c). The swapper leaves such address spaces alone.
+//
+// A system call checks a user pointer once, on the way in, so another thread must not unmap
+// the memory while the call still uses it: the kernel would fault on it. validuaddr pins what
+// it checked until the system call returns, and munmap, shmdetach and a shrinking sbrk wait
+// for the other threads' pins in what they take away (vmunmapstart). With one thread there is
+// nobody to race with and nothing is pinned.
+//
+
+#include "../../user/types.h"
+#include "../defs/defs.h"
+#include "../defs/param.h"
+#include "../arch/x86_32/mem/memlayout.h"
+#include "../arch/x86_32/mem/mmu.h"
+#include "../lock/spinlock.h"
+#include "../lock/sleeplock.h"
+#include "../sched/proc.h"
+#include "vmspace.h"
+
+struct {
+    struct spinlock lock;
+    struct vmspace vm[NPROC];
+} vmtable;
+
+void
+vmspaceinit(void) {
+    struct vmspace *vm;
+
+    initlock(&vmtable.lock, "vmtable");
+    for (vm = vmtable.vm; vm < &vmtable.vm[NPROC]; vm++) {
+        initsleeplock(&vm->lock, "vmspace");
+        initlock(&vm->pinlock, "vmpin");
+    }
+}
+
+/*
+ * A new empty address space around page table pgdir, with one reference. Returns 0 if the
+ * table is full.
+ */
+struct vmspace *
+vmspacealloc(pmde_t *pgdir) {
+    struct vmspace *vm;
+
+    acquire(&vmtable.lock);
+    for (vm = vmtable.vm; vm < &vmtable.vm[NPROC]; vm++) {
+        if (vm->ref == 0) {
+            vm->ref = 1;
+            release(&vmtable.lock);
+            vm->pgdir = pgdir;
+            vm->sz = 0;
+            vm->stack_base = STACK_BASE;
+            vm->rss = 0;
+            memset(vm->vmas, 0, sizeof(vm->vmas));
+            vm->tlbcpu = 0;
+            memset(vm->pins, 0, sizeof(vm->pins));
+            vm->uend = 0;
+            return vm;
+        }
+    }
+    release(&vmtable.lock);
+    return 0;
+}
+
+struct vmspace *
+vmspacedup(struct vmspace *vm) {
+    acquire(&vmtable.lock);
+    vm->ref++;
+    release(&vmtable.lock);
+    return vm;
+}
+
+/*
+ * Drop a reference to vm. The last one writes back and drops the mmap areas and frees the
+ * page table, which must not be loaded on this CPU by then for any other process.
+ */
+void
+vmspaceput(struct vmspace *vm) {
+    acquire(&vmtable.lock);
+    if (vm->ref < 1)
+        panic("vmspaceput");
+    if (vm->ref > 1) {
+        vm->ref--;
+        release(&vmtable.lock);
+        return;
+    }
+    release(&vmtable.lock);
+
+    // nobody else can get at vm now, the slot is handed out again only once ref is 0
+    munmapall(vm);
+    freevm(vm->pgdir);
+    vm->pgdir = 0;
+    acquire(&vmtable.lock);
+    vm->ref = 0;
+    release(&vmtable.lock);
+}
+
+// Add [start, end) to p's pins in vm, caller holds vm->pinlock. Returns 0 if there is no room.
+static int
+addpin(struct vmspace *vm, struct proc *p, uint32 start, uint32 end) {
+    struct vmpin *pn, *free = 0, *mine = 0;
+
+    for (pn = vm->pins; pn < &vm->pins[NPIN]; pn++) {
+        if (pn->end == 0) {
+            if (free == 0)
+                free = pn;
+        } else if (pn->p == p) {
+            if (start <= pn->end && pn->start <= end)
+                break;
+            mine = pn;
+        }
+    }
+    if (pn == &vm->pins[NPIN]) {
+        if (free) {
+            free->p = p;
+            free->start = start;
+            free->end = end;
+            return 1;
+        }
+        // out of slots, one of ours grows to cover both
+        if ((pn = mine) == 0)
+            return 0;
+    }
+    if (start < pn->start)
+        pn->start = start;
+    if (end > pn->end)
+        pn->end = end;
+    return 1;
+}
+
+/*
+ * Keep [start, end) of vm mapped until the current system call returns. Waits while another
+ * thread is unmapping part of it. Returns -1 if the process is killed meanwhile.
+ */
+int
+vmpin(struct vmspace *vm, uint32 start, uint32 end) {
+    struct proc *p = myproc();
+
+    if (vm->ref < 2)
+        return 0;
+    start = PGROUNDDOWN(start);
+    end = end > KERNBASE ? KERNBASE : PGROUNDUP(end);
+    if (start >= end)
+        return 0;
+    acquire(&vm->pinlock);
+    while ((vm->uend && start < vm->uend && vm->ustart < end) || !addpin(vm, p, start, end)) {
+        if (p->killed) {
+            release(&vm->pinlock);
+            return -1;
+        }
+        sleep(vm->pins, &vm->pinlock);
+    }
+    p->pinvm = vm;
+    release(&vm->pinlock);
+    return 0;
+}
+
+/*
+ * Drop p's pins, when its system call returns or it execs or exits.
+ */
+void
+vmunpin(struct proc *p) {
+    struct vmspace *vm = p->pinvm;
+    struct vmpin *pn;
+
+    if (vm == 0)
+        return;
+    acquire(&vm->pinlock);
+    for (pn = vm->pins; pn < &vm->pins[NPIN]; pn++) {
+        if (pn->end && pn->p == p)
+            pn->end = 0;
+    }
+    wakeup(vm->pins);
+    release(&vm->pinlock);
+    p->pinvm = 0;
+}
+
+/*
+ * Called with vm->lock held before unmapping [start, end) of vm. Waits until no other
+ * thread's system call has any of it pinned, letting go of vm->lock meanwhile, and then keeps
+ * new pins out of it until vmunmapdone. Returns 0 once the caller may go ahead, 1 if it had to
+ * wait and the caller must look at the mappings again, or -1 if the process was killed.
+ */
+int
+vmunmapstart(struct vmspace *vm, uint32 start, uint32 end) {
+    struct proc *p = myproc();
+    struct vmpin *pn;
+
+    if (vm->ref < 2)
+        return 0;
+    acquire(&vm->pinlock);
+    for (pn = vm->pins; pn < &vm->pins[NPIN]; pn++) {
+        if (pn->end && pn->p != p && start < pn->end && pn->start < end)
+            break;
+    }
+    if (pn == &vm->pins[NPIN]) {
+        vm->ustart = start;
+        vm->uend = end;
+        release(&vm->pinlock);
+        return 0;
+    }
+    if (p->killed) {
+        release(&vm->pinlock);
+        return -1;
+    }
+    releasesleep(&vm->lock);
+    sleep(vm->pins, &vm->pinlock);
+    release(&vm->pinlock);
+    acquiresleep(&vm->lock);
+    return 1;
+}
+
+/*
+ * The unmapping vmunmapstart let go ahead is done, let the pins in again.
+ */
+void
+vmunmapdone(struct vmspace *vm) {
+    acquire(&vm->pinlock);
+    if (vm->uend) {
+        vm->uend = 0;
+        wakeup(vm->pins);
+    }
+    release(&vm->pinlock);
+}
@@ -0,0 +1,29 @@
+// A user address space: the page table and what is mapped in it.
+// Threads made by clone share their parent's, see mm/vmspace.c.
+// Needs spinlock.h, sleeplock.h and proc.h (for struct vma).
+
+#define NPIN 16  // ranges the threads of an address space can have pinned at once
+
+// User memory a thread's system call is using, see vmpin.
+struct vmpin {
+  struct proc *p;
+  uint32 start;
+  uint32 end;                  // page aligned, 0 for a free slot
+};
+
+struct vmspace {
+  struct sleeplock lock;       // held while a thread changes the mappings
+  int ref;                     // threads using it, protected by the table lock
+  pmde_t *pgdir;               // Page table
+  uint32 sz;                   // Size of the heap (bytes)
+  uint32 stack_base;           // lowest mapped address of the user stack, grows down from STACK_BASE
+  uint32 rss;                  // Resident user pages, heap, stack and mmap areas
+  struct vma vmas[NVMA];       // mmap areas
+  struct cpu *tlbcpu;          // Last cpu to load pgdir, its TLB may hold our mappings
+  struct spinlock pinlock;     // protects pins, ustart and uend
+  struct vmpin pins[NPIN];     // pinned by the threads' system calls
+  uint32 ustart, uend;         // being unmapped, if uend is not 0
+};
+
+// Resident pages of the heap and stack, both are always fully mapped.
+#define IMAGEPAGES(vm) (PGROUNDUP((vm)->sz) / PGSIZE + (STACK_BASE - (vm)->stack_base) / PGSIZE)
@@ -5,15 +5,23 @@
 #include "../arch/x86_32/mem/mmu.h"
 #include "../arch/x86_32/x86.h"
 #include "../lock/spinlock.h"
+#include "../lock/sleeplock.h"
 #include "proc.h"
+#include "../mm/vmspace.h"
 #include "../arch/x86_32/mem/vm.h"
 #include "signals.h"
 #include "sched.h"
 #include "../arch/x86_32/mp/mp.h"
 #include "../data/queue.h"
 
+#define NPIDHASH 64
+
 int nextpid = 1;
 static struct proc *initproc;
+// Procs by pid, chained through pidnext. Changed under ptable.lock and
+// read under rcu_read_lock. A proc taken out is not reused until a grace
+// period has passed, so a reader walking through it stays on its chain.
+static struct proc *pidhash[NPIDHASH];
 extern void forkret(void);
 extern void trapret(void);
 static void wakeup1(void *chan);
@@ -28,8 +36,7 @@ cpuid() {
 }
 void
 pinit(void) {
-    initlock(&ptable.lock, "ptable");
-    init_cpu_avg_counter();
+    initmcslock(&ptable.lock, "ptable");
 }
 // Must be called with trap disabled to avoid the caller being
 // rescheduled between reading lapicid and running through the loop.
@@ -50,29 +57,6 @@ mycpu(void) {
     panic("unknown apicid\n");
 }
 
-/*
- * This will iterate through each process and tally up allocated pages in each processes page directory as
- * well as tallying up allocated kernel pages.
- */
-int freemem(void) {
-    uint32 total_pages = 0;
-    struct proc *p;
-    // Tally memory used by all procs
-
-    acquire(&ptable.lock);
-
-
-    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-        if (p->state != UNUSED) {
-            total_pages += tally_page_directory(p->pgdir);
-        }
-
-    }
-    release(&ptable.lock);
-
-    return total_pages;
-}
-
 // Disable trap so that we are not rescheduled
 // while reading proc from the cpu structure
 struct proc *
@@ -86,6 +70,66 @@ myproc(void) {
     return p;
 }
 
+// Caller holds ptable.lock.
+static void
+pidhashadd(struct proc *p) {
+    struct proc **h = &pidhash[(uint32) p->pid % NPIDHASH];
+
+    p->pidnext = *h;
+    rcu_assign_pointer(*h, p);
+}
+
+// Caller holds ptable.lock. p->pidnext is left alone for
+// readers that are on p right now.
+static void
+pidhashdel(struct proc *p) {
+    struct proc **pp;
+
+    for (pp = &pidhash[(uint32) p->pid % NPIDHASH]; *pp != p; pp = &(*pp)->pidnext)
+        if (*pp == 0)
+            panic("pidhashdel");
+    *pp = p->pidnext;
+}
+
+/*
+ * The process with pid pid, or 0 if there is none. Takes no lock; call it under
+ * rcu_read_lock. The proc is not freed after that, but it may exit and be reused,
+ * so check p->pid again under ptable.lock before changing it.
+ */
+struct proc *
+pidlookup(int pid) {
+    struct proc *p;
+
+    for (p = rcu_dereference(pidhash[(uint32) pid % NPIDHASH]); p != 0; p = rcu_dereference(p->pidnext))
+        if (p->pid == pid)
+            return p;
+    return 0;
+}
+
+static void
+procreuse(struct rcuhead *h) {
+    struct proc *p = rcu_entry(h, struct proc, rcu);
+
+    acquire(&ptable.lock);
+    p->state = UNUSED;
+    release(&ptable.lock);
+}
+
+/*
+ * Take p out of the pid hash and let allocproc have it again once no reader
+ * can be looking at it. Until then it keeps its state, with no pid and no
+ * parent. Called without ptable.lock.
+ */
+static void
+procfree(struct proc *p) {
+    acquire(&ptable.lock);
+    pidhashdel(p);
+    p->pid = 0;
+    p->parent = 0;
+    release(&ptable.lock);
+    call_rcu(&p->rcu, procreuse);
+}
+
 //PAGEBREAK: 32
 // Look in the process table for an UNUSED proc.
 // If found, change state to EMBRYO and initialize
@@ -109,13 +153,16 @@ allocproc(void) {
     found:
     p->state = EMBRYO;
     p->pid = nextpid++;
+    p->pinvm = 0;
+    memset(p->held, 0, sizeof(p->held));
+    pidhashadd(p);
 
 
     release(&ptable.lock);
 
     // Allocate kernel stack.
     if ((p->kstack = kalloc()) == 0) {
-        p->state = UNUSED;
+        procfree(p);
         return 0;
     }
     sp = p->kstack + KSTACKSIZE;
@@ -162,15 +209,18 @@ userinit(void) {
     initprocqueue(&readyqueue);
 
     struct proc *p;
+    pmde_t *pgdir;
     extern char _binary_initcode_start[], _binary_initcode_size[];
 
     p = allocproc();
 
     initproc = p;
-    if ((p->pgdir = setupkvm()) == 0)
+    if ((pgdir = setupkvm()) == 0 || (p->vm = vmspacealloc(pgdir)) == 0)
+        panic("userinit: out of memory?");
+    inituvm(p->vm->pgdir, _binary_initcode_start, (int) _binary_initcode_size);
+    if (vdatamap(p->vm->pgdir, p->pid) < 0)
         panic("userinit: out of memory?");
-    inituvm(p->pgdir, _binary_initcode_start, (int) _binary_initcode_size);
-    p->sz = PGSIZE;
+    p->vm->sz = PGSIZE;
     memset(p->tf, 0, sizeof(*p->tf));
     p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
     p->tf->ds = (SEG_UDATA << 3) | DPL_USER;
@@ -179,6 +229,8 @@ userinit(void) {
     p->tf->eflags = FL_IF;
     p->tf->esp = PGSIZE;
     p->tf->eip = 0;  // beginning of initcode.S
+    // initcode runs on its own page, no separate stack yet
+    p->vm->rss = IMAGEPAGES(p->vm);
     p->space_flag = USER_PROC;
 
     /*
@@ -202,7 +254,9 @@ userinit(void) {
 
     safestrcpy(p->name, "initcode", sizeof(p->name));
     //The init process' current working directory will be the root dir inode
-    p->cwd = namei(1,"/");
+    if ((p->files = filesalloc()) == 0)
+        panic("userinit: no files");
+    p->files->cwd = namei(1,"/");
 
     // this assignment to p->state lets other cores
     // run this process. the acquire forces the above
@@ -219,48 +273,160 @@ userinit(void) {
     release(&ptable.lock);
 }
 
+/*
+ * Start a kernel process that runs fn, which must never return. It has no user memory
+ * and never leaves the kernel. Returns its pid, or -1.
+ */
+int
+kproc(char *name, void (*fn)(void)) {
+    struct proc *p;
+    pmde_t *pgdir;
+
+    if ((p = allocproc()) == 0)
+        return -1;
+    if ((pgdir = setupkvm()) == 0 || (p->vm = vmspacealloc(pgdir)) == 0) {
+        if (pgdir)
+            freevm(pgdir);
+        kfree(p->kstack);
+        p->kstack = 0;
+        procfree(p);
+        return -1;
+    }
+    // forkret returns to fn rather than trapret (see allocproc)
+    *(uint32 *) (p->context + 1) = (uint32) fn;
+    p->files = 0;
+    p->parent = 0;
+    p->space_flag = KERNEL_PROC;
+    p->p_time_quantum = DEFAULT_USER_TIME_QUANTUM;
+    p->child_pri = CHILD_SAME_PRI;
+    p->p_pri = MED_USER_PRIORITY;
+    p->signal_handler = NULL;
+    p->p_ign = 0;
+    p->p_sig = 0;
+    safestrcpy(p->name, name, sizeof(p->name));
+
+    acquire(&ptable.lock);
+    p->state = RUNNABLE;
+    p->next = 0;
+    p->prev = 0;
+    p->queue_mask = 0;
+    p->curr_cpu = NOCPU;
+    insert_proc_into_queue(p, &readyqueue);
+    release(&ptable.lock);
+    return p->pid;
+}
+
 // Grow current process's memory by n bytes.
 // Return 0 on success, -1 on failure.
+// Caller holds myproc()->vm->lock.
 int
 growproc(int n) {
-    uint32 sz;
-    struct proc *curproc = myproc();
-
-    sz = curproc->sz;
+    uint32 sz, oldpages;
+    struct vmspace *vm = myproc()->vm;
+    struct tlbgather tg;
+    int r;
+
+    // a shrink waits for other threads' system calls to be done with what it frees
+    while (n < 0 && (r = vmunmapstart(vm, vm->sz + n, vm->sz)) != 0) {
+        if (r < 0)
+            return -1;
+    }
+    sz = vm->sz;
+    oldpages = IMAGEPAGES(vm);
     if (n > 0) {
-        if ((sz = allocuvm(curproc->pgdir, sz, sz + n,0)) == 0)
+        //the heap may not grow into the mmap areas
+        if (sz + n > MMAP_BASE || sz + n < sz)
+            return -1;
+        if ((sz = allocuvm(vm->pgdir, sz, sz + n,0)) == 0)
             return -1;
     } else if (n < 0) {
-        if ((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
+        // pages out on the swap disk are not in rss
+        vm->rss += swapcount(vm->pgdir, sz + n, sz);
+        tlbgatherinit(&tg, vm);
+        sz = deallocuvm(vm->pgdir, sz, sz + n, &tg);
+        // switchuvm skips the reload when the page table is already loaded,
+        // and other threads may still reach the pages, flush before freeing
+        tlbgatherflush(&tg);
+        vmunmapdone(vm);
+        if (sz == 0)
             return -1;
     }
-    curproc->sz = sz;
-    switchuvm(curproc);
+    vm->sz = sz;
+    vm->rss += IMAGEPAGES(vm) - oldpages;
 
     return 0;
 }
 
+/*
+ * Grow the current process's stack down to cover the faulting address addr.
+ * Called from the page fault handler. The stack may grow down to STACK_LIMIT,
+ * anything between the heap and that is off limits (the page just below it is the guard page).
+ * Returns 0 if the fault was handled, -1 if addr is not a valid stack address.
+ */
+int
+growstack(uint32 addr) {
+    uint32 base;
+    struct vmspace *vm = myproc()->vm;
+
+    if (addr < STACK_LIMIT)
+        return -1;
+    acquiresleep(&vm->lock);
+    // another thread may have grown it past addr while we waited
+    if (addr >= vm->stack_base) {
+        releasesleep(&vm->lock);
+        return addr < STACK_BASE ? 0 : -1;
+    }
+    if ((base = allocuvm(vm->pgdir, vm->stack_base, addr, 1)) == 0) {
+        releasesleep(&vm->lock);
+        return -1;
+    }
+    vm->rss += (vm->stack_base - base) / PGSIZE;
+    vm->stack_base = base;
+    releasesleep(&vm->lock);
+    return 0;
+}
+
 // Create a new process copying p as the parent.
 // Sets up stack to return as if from system call.
 // Caller must set state of returned proc to RUNNABLE.
 int
 fork(void) {
-    int i, pid;
+    int pid;
     struct proc *np;
     struct proc *curproc = myproc();
+    struct vmspace *vm = curproc->vm;
+    pmde_t *pgdir;
     // Allocate process.
     if ((np = allocproc()) == 0) {
         return -1;
     }
 
-    // Copy process state from proc.
-    if ((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0) {
+    // Copy process state from proc. Other threads wait to change the mappings until we are done.
+    acquiresleep(&vm->lock);
+    if ((pgdir = copyuvm(vm->pgdir, vm->sz, vm->stack_base)) == 0 || (np->vm = vmspacealloc(pgdir)) == 0) {
+        releasesleep(&vm->lock);
+        if (pgdir)
+            freevm(pgdir);
         kfree(np->kstack);
         np->kstack = 0;
-        np->state = UNUSED;
+        procfree(np);
         return -1;
     }
-    np->sz = curproc->sz;
+    np->vm->sz = vm->sz;
+    np->vm->stack_base = vm->stack_base;
+    np->vm->rss = IMAGEPAGES(vm);  // mmapfork adds the areas
+    if (mmapfork(np->vm, vm) < 0 || vdatamap(np->vm->pgdir, np->pid) < 0 ||
+        (np->files = filescopy(curproc->files)) == 0) {
+        releasesleep(&vm->lock);
+        vmspaceput(np->vm);
+        np->vm = 0;
+        kfree(np->kstack);
+        np->kstack = 0;
+        procfree(np);
+        return -1;
+    }
+    releasesleep(&vm->lock);
+    np->thread = 0;
     np->parent = curproc;
     *np->tf = *curproc->tf;
 
@@ -306,13 +472,6 @@ fork(void) {
 
 
     // Clear %eax so that fork returns 0 in the child.
-
-
-    for (i = 0; i < NOFILE; i++)
-        if (curproc->ofile[i])
-            np->ofile[i] = filedup(curproc->ofile[i]);
-    np->cwd = idup(curproc->cwd);
-
     safestrcpy(np->name, curproc->name, sizeof(curproc->name));
     np->tf->eax = 0;
     pid = np->pid;
@@ -341,33 +500,30 @@ exit(void) {
 
     struct proc *curproc = myproc();
     struct proc *p;
-    int fd;
     if (curproc == initproc) {
         panic("initproc exiting");
     }
-
-
-    // Close all open files.
-    for (fd = 0; fd < NOFILE; fd++) {
-        if (curproc->ofile[fd]) {
-            fileclose(curproc->ofile[fd]);
-            curproc->ofile[fd] = 0;
-        }
-    }
-
-    begin_op();
-    iput(curproc->cwd);
-    end_op();
-    curproc->cwd = 0;
+    // exit may come straight from a trap, tell the swapper this
+    // process is in the kernel and its pages are being torn down
+    change_process_space(KERNEL_PROC);
+    vmunpin(curproc);
+    fileunhold(curproc);
+
+    // Close all open files, unless other threads still use them. The address space is let
+    // go of by whoever reaps us (wait or join): until we are a zombie the scheduler may still
+    // switch to its page table.
+    filesput(curproc->files);
+    curproc->files = 0;
     acquire(&ptable.lock);
 
     // Parent might be sleeping in wait().
     wakeup1(curproc->parent);
 
-    // Pass abandoned children to init.
+    // Pass abandoned children to init, which reaps threads with wait like any other child.
     for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
         if (p->parent == curproc) {
             p->parent = initproc;
+            p->thread = 0;
             wakeup1(initproc);
         }
     }
@@ -393,12 +549,37 @@ exit(void) {
     panic("zombie exit");
 }
 
+// Free zombie child p and return its pid. Caller holds ptable.lock,
+// which is released.
+static int
+reap(struct proc *p) {
+    struct vmspace *vm;
+    int pid;
+
+    pid = p->pid;
+    kfree(p->kstack);
+    p->kstack = 0;
+    vm = p->vm;
+    p->vm = 0;
+    p->name[0] = 0;
+    p->killed = 0;
+    p->parent = 0;
+    p->thread = 0;
+    release(&ptable.lock);
+    procfree(p);
+    // If this was the last thread, the mmap areas are written back and
+    // the page table freed. freevm may have to wait for another CPU to
+    // switch off the page table, and that CPU may need ptable.lock to do it.
+    vmspaceput(vm);
+    return pid;
+}
+
 // Wait for a child process to exit and return its pid.
-// Return -1 if this process has no children.
+// Return -1 if this process has no children. Threads are left for join.
 int
 wait(void) {
     struct proc *p;
-    int havekids, pid;
+    int havekids;
     struct proc *curproc = myproc();
 
     acquire(&ptable.lock);
@@ -406,23 +587,11 @@ wait(void) {
         // Scan through table looking for exited children.
         havekids = 0;
         for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-            if (p->parent != curproc)
+            if (p->parent != curproc || p->thread)
                 continue;
             havekids = 1;
-            if (p->state == ZOMBIE) {
-                // Found one.
-                pid = p->pid;
-                kfree(p->kstack);
-                p->kstack = 0;
-                freevm(p->pgdir);
-                p->pid = 0;
-                p->parent = 0;
-                p->name[0] = 0;
-                p->killed = 0;
-                p->state = UNUSED;
-                release(&ptable.lock);
-                return pid;
-            }
+            if (p->state == ZOMBIE)
+                return reap(p);
         }
 
         // No point waiting if we don't have any children.
@@ -438,6 +607,91 @@ wait(void) {
     }
 }
 
+/*
+ * Start a thread: a new process sharing the caller's address space and open files, which
+ * calls fn(arg) on the user stack whose top is stack. The caller (sys_clone) has checked the
+ * two words below stack, which get arg and a return address that faults, so fn must exit.
+ * Returns the thread's pid, or -1.
+ */
+int
+clone(void (*fn)(void *), void *arg, void *stack) {
+    struct proc *np;
+    struct proc *curproc = myproc();
+    uint32 sp, ustack[2];
+
+    // before allocproc, whose kalloc may page out the stack just checked
+    ustack[0] = 0xffffffff;  // fake return PC
+    ustack[1] = (uint32) arg;
+    sp = (uint32) stack - sizeof(ustack);
+    memmove((void *) sp, ustack, sizeof(ustack));
+
+    if ((np = allocproc()) == 0)
+        return -1;
+    vdatathreaded(curproc->vm->pgdir);
+    np->vm = vmspacedup(curproc->vm);
+    np->files = filesdup(curproc->files);
+    np->thread = 1;
+    np->ustack = (uint32) stack;
+    np->parent = curproc;
+
+    *np->tf = *curproc->tf;
+    np->tf->esp = sp;
+    np->tf->eip = (uint32) fn;
+    np->tf->eax = 0;
+
+    // scheduling and signals as for fork
+    np->p_flag = 0;
+    np->queue_mask = 0;
+    np->p_pri = curproc->p_pri;
+    np->p_cpu_usage = 0;
+    np->p_time_quantum = curproc->p_cpu_usage / 2;
+    curproc->p_time_quantum -= np->p_time_quantum;
+    np->signal_handler = (void *) 0;
+    np->p_ign = 0;
+    np->p_sig = 0;
+    safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+    np->next = 0;
+    np->prev = 0;
+    np->curr_cpu = NOCPU;
+    np->curr = 0;
+
+    acquire(&ptable.lock);
+    np->state = RUNNABLE;
+    release(&ptable.lock);
+    insert_proc_into_queue(np, &readyqueue);
+    return np->pid;
+}
+
+/*
+ * Wait for a thread started by this process to exit and return its pid, with the stack it was
+ * given in *stack so it can be freed. Return -1 if there are none.
+ */
+int
+join(void **stack) {
+    struct proc *p;
+    int havekids;
+    struct proc *curproc = myproc();
+
+    acquire(&ptable.lock);
+    for (;;) {
+        havekids = 0;
+        for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
+            if (p->parent != curproc || !p->thread)
+                continue;
+            havekids = 1;
+            if (p->state == ZOMBIE) {
+                *stack = (void *) p->ustack;
+                return reap(p);
+            }
+        }
+        if (!havekids || curproc->killed) {
+            release(&ptable.lock);
+            return -1;
+        }
+        sleep(curproc, &ptable.lock);
+    }
+}
+
 //PAGEBREAK: 42
 
 // A fork child's very first scheduling by scheduler()
@@ -457,8 +711,6 @@ forkret(void) {
         iinit(SECONDARYDEV,2);
         initlog(ROOTDEV);
         initlog(SECONDARYDEV);
-
-        init_cpu_avg_counter();
     }
 
 
@@ -557,19 +809,39 @@ int
 kill(int pid) {
     struct proc *p;
 
+    rcu_read_lock();
+    p = pidlookup(pid);
+    rcu_read_unlock();
+    if (p == 0)
+        return -1;
     acquire(&ptable.lock);
-    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-        if (p->pid == pid) {
-            p->killed = 1;
-            // Wake process from sleep if necessary.
-            if (p->state == SLEEPING)
-                p->state = RUNNABLE;
-            release(&ptable.lock);
-            return 0;
-        }
+    if (p->pid != pid) {
+        // it was reaped in the meantime
+        release(&ptable.lock);
+        return -1;
     }
+    p->killed = 1;
+    // Wake process from sleep if necessary.
+    if (p->state == SLEEPING)
+        p->state = RUNNABLE;
     release(&ptable.lock);
-    return -1;
+    return 0;
+}
+
+/*
+ * Resident pages of process pid, or -1 if there is no such process.
+ */
+int
+procrss(int pid) {
+    struct proc *p;
+    struct vmspace *vm;
+    int rss = -1;
+
+    rcu_read_lock();
+    if ((p = pidlookup(pid)) != 0)
+        rss = (vm = p->vm) != 0 ? vm->rss : 0;
+    rcu_read_unlock();
+    return rss;
 }
 
 
@@ -589,25 +861,26 @@ int sig(int sigmask, int pid) {
     }
 
 
-    acquire(&ptable.lock);
-    for (proc = ptable.proc; proc < &ptable.proc[NPROC]; proc++) {
-        if (proc->pid == pid && proc->state != UNUSED) {
-            //set the signal
-            proc->p_sig |= sigmask;
-            // Wake process from sleep if necessary.
-            if (proc->state != RUNNING) {
-                proc->state = RUNNABLE;
-            }
-            proc->p_pri = TOP_PRIORITY;
-            release(&ptable.lock);
-            return 0;
-        }
-
+    rcu_read_lock();
+    proc = pidlookup(pid);
+    rcu_read_unlock();
+    if (proc == 0)
+        return ENOPROC;
 
+    acquire(&ptable.lock);
+    if (proc->pid != pid) {
+        release(&ptable.lock);
+        return ENOPROC;
     }
-
+    //set the signal
+    proc->p_sig |= sigmask;
+    // Wake process from sleep if necessary.
+    if (proc->state != RUNNING) {
+        proc->state = RUNNABLE;
+    }
+    proc->p_pri = TOP_PRIORITY;
     release(&ptable.lock);
-    return ENOPROC;
+    return 0;
 }
 
 /*
@@ -1,3 +1,5 @@
+#include "../lock/rcu.h"
+
 // Per-CPU state
 
 struct cpu {
@@ -9,6 +11,9 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were trap enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  pmde_t *pgdir;               // Page table in %cr3, may outlive proc (lazy TLB)
+  volatile uint32 tlbreq;      // CPUs waiting for this one to flush its TLB, see tlbshootdown
+  uint32 sysstack[128];        // Stack sysenter lands on, see sysenterinit
 };
 
 
@@ -66,12 +71,31 @@ enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE, WAIT, PREE
 #define ESIG                    1000000000    //Bad signal || no such signal
 #define ENOPROC                 1000000001    // No proc of this pid found
 
+// A memory mapped area, see mm/mmap.c.
+// start and len are page aligned, len == 0 means the slot is free.
+struct vma {
+  uint32 start;                // First address of the area
+  uint32 len;                  // Length in bytes
+  int prot;                    // PROT_READ / PROT_WRITE
+  int flags;                   // MAP_SHARED / MAP_PRIVATE / MAP_ANONYMOUS
+  struct file *file;           // Backing file, 0 for anonymous memory
+  struct shm *shm;             // Shared memory segment, see ipc/shm.c
+  uint32 off;                  // File offset of start
+};
+
+// Open files and current directory, shared by the threads of a process.
+struct files {
+  struct spinlock lock;        // protects ofile
+  int ref;                     // threads using it, protected by the table lock in fs/file.c
+  struct file *ofile[NOFILE];  // Open files
+  struct inode *cwd;           // Current directory
+};
+
 //Important flags for PFLAG
 #define IN_QUEUE               0x1
 // Per-process state
 struct proc {
-  uint32 sz;                     // Size of process memory (bytes)
-  uint32 stack_base;              //stack base
+  struct vmspace *vm;          // Address space, see mm/vmspace.h
   int p_sig;                   //The signal sent to this process
   void (*signal_handler)(int); // Pointer to signal handler function
   int p_ign;                   //flag to ignore signals (other than a kill, seg fault)
@@ -82,7 +106,6 @@ struct proc {
   int queue_mask;              //for enqueuing / dequeuing purposes
   int space_flag;              //flag to mark a process as either kernel space or user space
   int child_pri;               //A binary flag that will just indicate whether any children on fork should retain the same scheduling priority.
-  pmde_t* pgdir;                // Page table
   char *kstack;                // Bottom of kernel stack for this process
   enum procstate state;        // Process state
   int pid;                     // Process ID
@@ -91,20 +114,27 @@ struct proc {
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
-  struct file *ofile[NOFILE];  // Open files
-  struct inode *cwd;           // Current directory
+  struct files *files;         // Open files and current directory
+  int thread;                  // Made by clone, reaped by join rather than wait
+  uint32 ustack;               // clone: the stack it was given, join hands it back
+  struct vmspace *pinvm;       // where the current system call pinned memory, see vmpin
+  struct file *held[2];        // open files the current system call uses, see fileget
   char name[16];               // Process name (debugging)
   struct proc *next;           // Will work this doubly linked list for scheduling right into the process table, like what was done with the buffer cache
   struct proc *prev;           // Will work this doubly linked list for scheduling right into the process table, like what was done with the buffer cache
   int curr_cpu;                //the cpu this proc is queued on
   struct pqueue *curr;         //address of the current queue this proc is in
+  struct proc *pidnext;        // pid hash chain, see pidlookup
+  struct rcuhead rcu;          // for going back to UNUSED after a grace period
 };
 
-// Process memory is laid out contiguously, low addresses first:
+// Process memory is laid out like so, low addresses first:
 //   text
 //   original data and bss
-//   fixed-size stack
-//   expandable heap
+//   expandable heap (up to STACK_GUARD)
+//   ...
+//   stack guard page
+//   stack, grows down on fault from STACK_BASE to STACK_LIMIT
 
 extern struct proctable {
     struct spinlock lock;
@@ -113,7 +143,6 @@ extern struct proctable {
 
 
 /* Dustyn's extra functions */
-uint32 tally_allocated_memory_for_all_procs(void);
 void inc_time_quantum(struct proc *p);
 void change_process_space(int state_flag);
 void preempt(void);
@@ -14,6 +14,7 @@
 #include "signals.h"
 #include "sched.h"
 #include "../data/queue.h"
+#include "../data/counters.h"
 
 /*
  * This will be a doubly linked list where processes of higher or lower priorities will be sorted either at the head or the ass end depending on priority.
@@ -32,37 +33,25 @@ int queueinit = 0;
 
 
 /*
- * After each proc has finished, we can add its cpu usage to the total_cpu_time
- * increment n_procs, and then divide total_cpu_time by n_procs to get our new mean
+ * After each proc has finished, we add its cpu usage to the CNT_EXITTIME counter and
+ * count it in CNT_EXIT. Both are per-CPU counters, so exiting bounces no shared cache line,
+ * and the mean is only worked out when someone asks for it.
  */
 
-struct cpu_avg {
-    uint32 total_cpu_time;
-    uint32 n_procs;
-    uint32 avg;
-};
-
-struct cpu_avg c_avg;
-
-//init our counter, dummy value to start with avg
-void init_cpu_avg_counter() {
-    c_avg.avg = 25;
-    c_avg.n_procs = 0;
-    c_avg.total_cpu_time = 0;
-}
-
-
-//Update with the new average
+//Count a finished proc
 void update_cpu_avg(uint32 ticks) {
-    c_avg.total_cpu_time += ticks;
-    c_avg.n_procs++;
-    c_avg.avg = c_avg.total_cpu_time / c_avg.n_procs;
+    countinc(CNT_EXIT);
+    countadd(CNT_EXITTIME, ticks);
 }
 
 
-//get the avg clock cycles per proc
+//get the avg clock cycles per proc, a dummy value until a proc has finished
 uint32 get_cpu_avg() {
-    return c_avg.avg;
+    uint32 n = countsum(CNT_EXIT);
+
+    if (n == 0)
+        return 25;
+    return countsum(CNT_EXITTIME) / n;
 }
 
 
@@ -92,8 +81,15 @@ scheduler(void) {
         // Enable trap on this processor.
         sti();
         main:
+        // Nothing this CPU read under rcu_read_lock is in use any more.
+        rcuquiesce(this_cpu);
        //tight loop, can fill this with other tasks and routines later
         if (is_queue_empty(&readyqueue) && is_queue_empty(&runqueue[this_cpu])){
+            // Nothing to run, let go of the last process's page table (see freevm).
+            if (c->pgdir != kpgdir)
+                switchkvm();
+            // Get some pages ready for kalloc_zeroed while we wait.
+            kzeroidle();
             //Check if the queues are balanced, if not pluck some out and place them in the ready queue where this cpu can snag them.
             if((qmask = queues_need_balance()) > 0 ){
                 do_balance(qmask);
@@ -122,15 +118,22 @@ scheduler(void) {
         if (is_queue_empty(&runqueue[this_cpu])) {
            goto main;
         }
-        c->proc = runqueue[this_cpu].head;
-        switchuvm(runqueue[this_cpu].head);
+        p = runqueue[this_cpu].head;
+        c->proc = p;
+        // under ptable.lock, so that swapout can't change p's page table after this
         acquire(&ptable.lock);
-        runqueue[this_cpu].head->state = RUNNING;
+        switchuvm(p);
+        p->state = RUNNING;
 
 
-        swtch(&(c->scheduler), runqueue[this_cpu].head->context);
+        countinc(CNT_SWITCH);
+        swtch(&(c->scheduler), p->context);
         shift_queue(&runqueue[this_cpu]);
-        switchkvm();
+        // Keep running on p's page table, if p is picked again next the
+        // switch costs no CR3 reload. A process that exited is about to
+        // have its page table freed, so don't hold on to that one.
+        if (p->state == ZOMBIE)
+            switchkvm();
         // Process is done running for now.
         // It should have changed its p->state before coming back.
         c->proc = 0;
@@ -21,8 +21,6 @@ uint32 get_cpu_avg();
 
 void update_cpu_avg(uint32 ticks);
 
-void init_cpu_avg_counter();
-
 void scheduler(void);
 
 
@@ -0,0 +1,42 @@
+// Submission and completion rings for ringenter, shared with user space.
+//
+// A process queues operations on sq by filling sq[sqtail % RING_ENTRIES]
+// and then advancing sqtail, and makes one ringenter call for the lot.
+// The kernel runs them in order, advancing sqhead, and posts each result
+// on cq at cqtail. The process reads the results from cqhead and advances
+// it to make room. A ring is ordinary memory of the process; it only has
+// to be writable.
+
+#define RING_ENTRIES 64  // slots in each ring
+
+// Operations, each behaving like the system call of the same name
+#define RING_NOP    0
+#define RING_READ   1   // fd, addr = buffer, len = bytes
+#define RING_WRITE  2   // fd, addr = buffer, len = bytes
+#define RING_OPEN   3   // addr = path, len = O_ flags; result is the fd
+#define RING_CLOSE  4   // fd
+#define RING_FSTAT  5   // fd, addr = struct stat
+
+// Submission queue entry
+struct sqe {
+  uint32 op;
+  int fd;
+  uint32 addr;
+  uint32 len;
+  uint32 data;    // handed back untouched in the completion
+};
+
+// Completion queue entry
+struct cqe {
+  uint32 data;
+  int res;        // what the system call would have returned
+};
+
+struct ring {
+  uint32 sqhead;  // next entry the kernel runs
+  uint32 sqtail;  // next free slot, advanced by the process
+  uint32 cqhead;  // next result the process reads
+  uint32 cqtail;  // next free slot, advanced by the kernel
+  struct sqe sq[RING_ENTRIES];
+  struct cqe cq[RING_ENTRIES];
+};
@@ -4,49 +4,91 @@
 #include "../arch/x86_32/mem/memlayout.h"
 #include "../arch/x86_32/mem/mmu.h"
 #include "../lock/spinlock.h"
+#include "../lock/sleeplock.h"
 #include "../sched/proc.h"
+#include "../mm/vmspace.h"
 #include "../arch/x86_32/x86.h"
 #include "syscall.h"
 #include "../sched/signals.h"
+#include "../data/counters.h"
 
-// User code makes a system call with INT T_SYSCALL.
+// User code makes a system call with SYSENTER, or INT T_SYSCALL.
 // System call number in %eax.
 // Arguments on the stack, from the user call to the C
 // library system call function. The saved user %esp points
 // to a saved program counter, and then the first argument.
 
+// Is [addr, addr+n) inside the process image, the mapped
+// part of its stack or one of its mmap areas? write says
+// whether the kernel is going to write through the pointer.
+static int
+validuaddr(struct vmspace *vm, uint32 addr, uint32 n, int write)
+{
+  if(addr + n < addr)
+    return 0;
+  // other threads leave it mapped until the system call returns
+  if(vmpin(vm, addr, addr + n) < 0)
+    return 0;
+  // pages out on the swap disk come back now, the kernel may touch them with a spinlock held
+  if(addr < vm->sz && addr + n <= vm->sz)
+    return swapinrange(vm, addr, n) == 0;
+  if(addr >= vm->stack_base && addr < STACK_BASE && addr + n <= STACK_BASE)
+    return swapinrange(vm, addr, n) == 0;
+  return mmapvalid(vm, addr, n, write);
+}
+
 // Fetch the int at addr from the current process.
 int
 fetchint(uint32 addr, int *ip)
 {
-  struct proc *curproc = myproc();
+  struct vmspace *vm = myproc()->vm;
 
-  if(addr >= curproc->sz || addr+4 > curproc->sz)
+  if(!validuaddr(vm, addr, 4, 0))
     return -1;
   *ip = *(int*)(addr);
   return 0;
 }
 
-// Fetch the nul-terminated string at addr from the current process.
-// Doesn't actually copy the string - just sets *pp to point at it.
-// Returns length of string, not including nul.
+// Copy the nul-terminated string at addr from the current process
+// into buf, which holds max bytes. The copy is what the kernel uses:
+// other threads, or other processes through shared memory, may change
+// the string meanwhile. Returns length of string, not including nul,
+// or -1 if it doesn't fit.
 int
-fetchstr(uint32 addr, char **pp)
+fetchstr(uint32 addr, char *buf, int max)
 {
   char *s, *ep;
-  struct proc *curproc = myproc();
+  int i;
+  struct vmspace *vm = myproc()->vm;
 
-  if(addr >= curproc->sz)
+  if(addr < vm->sz)
+    ep = (char*)vm->sz;
+  else if(addr >= vm->stack_base && addr < STACK_BASE)
+    ep = (char*)STACK_BASE;
+  else if((ep = (char*)mmapend(vm, addr)) == 0)
     return -1;
-  *pp = (char*)addr;
-  ep = (char*)curproc->sz;
-  for(s = *pp; s < ep; s++){
-    if(*s == 0)
-      return s - *pp;
+  for(i = 0, s = (char*)addr; i < max && s < ep; i++, s++){
+    // mmap pages are filled in as the string crosses into them
+    if((i == 0 || (uint32)s % PGSIZE == 0) && !validuaddr(vm, (uint32)s, 1, 0))
+      return -1;
+    if((buf[i] = *s) == 0)
+      return i;
   }
   return -1;
 }
 
+// Check that the size bytes at addr are memory the process
+// may hand to the kernel, for pointers that are not themselves
+// system call arguments. write is as for validuaddr.
+int
+fetchptr(uint32 addr, char **pp, int size, int write)
+{
+  if(size < 0 || !validuaddr(myproc()->vm, addr, size, write))
+    return -1;
+  *pp = (char*)addr;
+  return 0;
+}
+
 // Fetch the nth 32-bit system call argument.
 int
 argint(int n, int *ip)
@@ -61,27 +103,33 @@ int
 argptr(int n, char **pp, int size)
 {
   int i;
-  struct proc *curproc = myproc();
- 
+
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint32)i >= curproc->sz || (uint32)i+size > curproc->sz)
+  return fetchptr((uint32)i, pp, size, 0);
+}
+
+// Like argptr, but the kernel is going to write to the
+// memory so read-only mappings are refused.
+int
+argptrw(int n, char **pp, int size)
+{
+  int i;
+
+  if(argint(n, &i) < 0)
     return -1;
-  *pp = (char*)i;
-  return 0;
+  return fetchptr((uint32)i, pp, size, 1);
 }
 
-// Fetch the nth word-sized system call argument as a string pointer.
-// Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// Fetch the nth word-sized system call argument as a string,
+// copied into buf of max bytes, see fetchstr.
 int
-argstr(int n, char **pp)
+argstr(int n, char *buf, int max)
 {
   int addr;
   if(argint(n, &addr) < 0)
     return -1;
-  return fetchstr(addr, pp);
+  return fetchstr(addr, buf, max);
 }
 
 extern int sys_chdir(void);
@@ -112,6 +160,28 @@ extern int sys_sigignore(void);
 extern int sys_changeconsmode(void);
 extern int sys_mount(void);
 extern int sys_umount(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_msync(void);
+extern int sys_shmcreate(void);
+extern int sys_shmattach(void);
+extern int sys_shmdetach(void);
+extern int sys_rss(void);
+extern int sys_memstat(void);
+extern int sys_ringenter(void);
+extern int sys_lockstat(void);
+extern int sys_counters(void);
+extern int sys_futex(void);
+extern int sys_semopen(void);
+extern int sys_semwait(void);
+extern int sys_semtrywait(void);
+extern int sys_sempost(void);
+extern int sys_semclose(void);
+extern int sys_clone(void);
+extern int sys_join(void);
+extern int sys_splice(void);
+extern int sys_vmsplice(void);
+extern int sys_sendfile(void);
 
 
 static int (*syscalls[])(void) = {
@@ -143,6 +213,28 @@ static int (*syscalls[])(void) = {
 [SYS_changeconsmode] sys_changeconsmode,
 [SYS_mount] sys_mount,
 [SYS_umount] sys_umount,
+[SYS_mmap]   sys_mmap,
+[SYS_munmap] sys_munmap,
+[SYS_msync]  sys_msync,
+[SYS_shmcreate] sys_shmcreate,
+[SYS_shmattach] sys_shmattach,
+[SYS_shmdetach] sys_shmdetach,
+[SYS_rss]    sys_rss,
+[SYS_memstat] sys_memstat,
+[SYS_ringenter] sys_ringenter,
+[SYS_lockstat] sys_lockstat,
+[SYS_counters] sys_counters,
+[SYS_futex]   sys_futex,
+[SYS_semopen] sys_semopen,
+[SYS_semwait] sys_semwait,
+[SYS_semtrywait] sys_semtrywait,
+[SYS_sempost] sys_sempost,
+[SYS_semclose] sys_semclose,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_splice]  sys_splice,
+[SYS_vmsplice] sys_vmsplice,
+[SYS_sendfile] sys_sendfile,
 };
 
 void
@@ -151,11 +243,14 @@ syscall(void)
   int num;
   struct proc *curproc = myproc();
   num = curproc->tf->eax;
+  countinc(CNT_SYSCALL);
   change_process_space(KERNEL_PROC);
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
 
 
     curproc->tf->eax = syscalls[num]();
+    vmunpin(curproc);
+    fileunhold(curproc);
     change_process_space(USER_PROC);
 
   } else {
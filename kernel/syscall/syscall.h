@@ -27,3 +27,26 @@
 #define SYS_changeconsmode 26
 #define SYS_mount          27
 #define SYS_umount         28
+
+#define SYS_mmap           29
+#define SYS_munmap         30
+#define SYS_msync          31
+#define SYS_shmcreate      32
+#define SYS_shmattach      33
+#define SYS_shmdetach      34
+#define SYS_rss            35
+#define SYS_memstat        36
+#define SYS_ringenter      37
+#define SYS_lockstat       38
+#define SYS_counters       39
+#define SYS_futex          40
+#define SYS_semopen        41
+#define SYS_semwait        42
+#define SYS_semtrywait     43
+#define SYS_sempost        44
+#define SYS_semclose       45
+#define SYS_clone          46
+#define SYS_join           47
+#define SYS_splice         48
+#define SYS_vmsplice       49
+#define SYS_sendfile       50
\ No newline at end of file
@@ -15,6 +15,8 @@
 #include "../lock/sleeplock.h"
 #include "../fs/file.h"
 #include "../fs/xfcntl.h"
+#include "../mm/mman.h"
+#include "ring.h"
 
 
 // Fetch the nth word-sized system call argument as a file descriptor
@@ -27,7 +29,7 @@ argfd(int n, int *pfd, struct file **pf)
 
   if(argint(n, &fd) < 0)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if((f = fileget(fd)) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
@@ -42,14 +44,17 @@ static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *curproc = myproc();
+  struct files *fs = myproc()->files;
 
+  acquire(&fs->lock);
   for(fd = 0; fd < NOFILE; fd++){
-    if(curproc->ofile[fd] == 0){
-      curproc->ofile[fd] = f;
+    if(fs->ofile[fd] == 0){
+      fs->ofile[fd] = f;
+      release(&fs->lock);
       return fd;
     }
   }
+  release(&fs->lock);
   return -1;
 }
 
@@ -74,7 +79,7 @@ sys_read(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptrw(1, &p, n) < 0)
     return -1;
   return fileread(f, p, n);
 }
@@ -91,26 +96,42 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
-int
-sys_close(void)
+static int
+closefd(int fd)
 {
-  int fd;
   struct file *f;
+  struct files *fs = myproc()->files;
 
-  if(argfd(0, &fd, &f) < 0)
+  if(fd < 0 || fd >= NOFILE)
     return -1;
-  myproc()->ofile[fd] = 0;
+  acquire(&fs->lock);
+  if((f = fs->ofile[fd]) == 0){
+    release(&fs->lock);
+    return -1;
+  }
+  fs->ofile[fd] = 0;
+  release(&fs->lock);
   fileclose(f);
   return 0;
 }
 
+int
+sys_close(void)
+{
+  int fd;
+
+  if(argint(0, &fd) < 0)
+    return -1;
+  return closefd(fd);
+}
+
 int
 sys_fstat(void)
 {
   struct file *f;
   struct stat *st;
 
-  if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+  if(argfd(0, 0, &f) < 0 || argptrw(1, (void*)&st, sizeof(*st)) < 0)
     return -1;
   return filestat(f, st);
 }
@@ -119,10 +140,10 @@ sys_fstat(void)
 int
 sys_link(void)
 {
-  char name[DIRSIZ], *new, *old;
+  char name[DIRSIZ], new[MAXPATH], old[MAXPATH];
   struct inode *dp, *ip;
 
-  if(argstr(0, &old) < 0 || argstr(1, &new) < 0)
+  if(argstr(0, old, sizeof(old)) < 0 || argstr(1, new, sizeof(new)) < 0)
     return -1;
 
   begin_op();
@@ -188,10 +209,10 @@ sys_unlink(void)
   struct inode *ip, *dp;
   //this is directory entry, we need to name things better names i was like what the fuck is a dirent
   struct dirent de;
-  char name[DIRSIZ], *path;
+  char name[DIRSIZ], path[MAXPATH];
   uint32 off;
 
-  if(argstr(0, &path) < 0)
+  if(argstr(0, path, sizeof(path)) < 0)
     return -1;
 
   begin_op();
@@ -284,17 +305,13 @@ create(char *path, short type, short major, short minor)
   return ip;
 }
 
-int
-sys_open(void)
+static int
+openpath(char *path, int omode)
 {
-  char *path;
-  int fd, omode;
+  int fd;
   struct file *f;
   struct inode *ip;
 
-  if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
-    return -1;
-
   begin_op();
 
   if(omode & O_CREATE){
@@ -334,14 +351,25 @@ sys_open(void)
   return fd;
 }
 
+int
+sys_open(void)
+{
+  char path[MAXPATH];
+  int omode;
+
+  if(argstr(0, path, sizeof(path)) < 0 || argint(1, &omode) < 0)
+    return -1;
+  return openpath(path, omode);
+}
+
 int
 sys_mkdir(void)
 {
-  char *path;
+  char path[MAXPATH];
   struct inode *ip;
 
   begin_op();
-  if(argstr(0, &path) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
+  if(argstr(0, path, sizeof(path)) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
     end_op();
     return -1;
   }
@@ -354,11 +382,11 @@ int
 sys_mknod(void)
 {
   struct inode *ip;
-  char *path;
+  char path[MAXPATH];
   int major, minor;
 
   begin_op();
-  if((argstr(0, &path)) < 0 ||
+  if((argstr(0, path, sizeof(path))) < 0 ||
      argint(1, &major) < 0 ||
      argint(2, &minor) < 0 ||
      (ip = create(path, T_DEV, major, minor)) == 0){
@@ -373,12 +401,12 @@ sys_mknod(void)
 int
 sys_chdir(void)
 {
-  char *path;
-  struct inode *ip;
-  struct proc *curproc = myproc();
-  
+  char path[MAXPATH];
+  struct inode *ip, *old;
+  struct files *fs = myproc()->files;
+
   begin_op();
-  if(argstr(0, &path) < 0 || (ip = namei(0,path)) == 0){
+  if(argstr(0, path, sizeof(path)) < 0 || (ip = namei(0,path)) == 0){
     end_op();
     return -1;
   }
@@ -389,36 +417,51 @@ sys_chdir(void)
     return -1;
   }
   iunlock(ip);
-  iput(curproc->cwd);
+  acquire(&fs->lock);
+  old = fs->cwd;
+  fs->cwd = ip;
+  release(&fs->lock);
+  iput(old);
   end_op();
-  curproc->cwd = ip;
   return 0;
 }
 
 int
 sys_exec(void)
 {
-  char *path, *argv[MAXARG];
-  int i;
+  char path[MAXPATH], *argv[MAXARG], *buf, *s;
+  int i, n, r;
   uint32 uargv, uarg;
 
-  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0){
+  if(argstr(0, path, sizeof(path)) < 0 || argint(1, (int*)&uargv) < 0){
     return -1;
   }
+  // the strings are copied into one page, exec throws the
+  // user memory they came from away
+  if((buf = kalloc()) == 0)
+    return -1;
   memset(argv, 0, sizeof(argv));
+  r = -1;
+  s = buf;
   for(i=0;; i++){
     if(i >= NELEM(argv))
-      return -1;
+      goto out;
     if(fetchint(uargv+4*i, (int*)&uarg) < 0)
-      return -1;
+      goto out;
     if(uarg == 0){
       argv[i] = 0;
       break;
     }
-    if(fetchstr(uarg, &argv[i]) < 0)
-      return -1;
+    if((n = fetchstr(uarg, s, buf + PGSIZE - s)) < 0)
+      goto out;
+    argv[i] = s;
+    s += n + 1;
   }
-  return exec(path, argv);
+  r = exec(path, argv);
+
+out:
+  kfree(buf);
+  return r;
 }
 
 int
@@ -428,14 +471,14 @@ sys_pipe(void)
   struct file *rf, *wf;
   int fd0, fd1;
 
-  if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
+  if(argptrw(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
     return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      myproc()->ofile[fd0] = 0;
+      myproc()->files->ofile[fd0] = 0;
     fileclose(rf);
     fileclose(wf);
     return -1;
@@ -445,6 +488,149 @@ sys_pipe(void)
   return 0;
 }
 
+// splice(in, out, n): move up to n bytes from in to out inside
+// the kernel, where one of them is a pipe and the other a pipe or
+// an inode. Returns the bytes moved, 0 at end of input, or -1.
+int
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0 || n < 0)
+    return -1;
+  if(!in->readable || !out->writable)
+    return -1;
+  if(in->type == FD_PIPE && out->type == FD_PIPE)
+    return pipesplice(in->pipe, out->pipe, n);
+  if(in->type == FD_INODE && out->type == FD_PIPE)
+    return pipesplicein(out->pipe, in->ip, &in->off, n);
+  if(in->type == FD_PIPE && out->type == FD_INODE)
+    return pipespliceout(in->pipe, out, n);
+  return -1;
+}
+
+// sendfile(out, in, off, n): copy up to n bytes of file in to out,
+// a file or pipe, inside the kernel. Reads from byte off of in, or
+// from in's offset if off is negative, which then moves on.
+int
+sys_sendfile(void)
+{
+  struct file *out, *in;
+  int off, n;
+  uint32 uoff;
+
+  if(argfd(0, 0, &out) < 0 || argfd(1, 0, &in) < 0 || argint(2, &off) < 0 ||
+     argint(3, &n) < 0 || n < 0)
+    return -1;
+  if(in->type != FD_INODE || !in->readable || !out->writable)
+    return -1;
+  if(off < 0)
+    return filesend(out, in, &in->off, n);
+  uoff = off;
+  return filesend(out, in, &uoff, n);
+}
+
+// vmsplice(fd, buf, n): write buf to pipe fd, handing it whole
+// pages of buf instead of copying them, see pipegift.
+int
+sys_vmsplice(void)
+{
+  struct file *f;
+  char *p;
+  int n;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+    return -1;
+  if(f->type != FD_PIPE || !f->writable)
+    return -1;
+  return pipegift(f->pipe, p, n);
+}
+
+// Fetch the nth system call argument as a descriptor for a named semaphore.
+static int
+argsem(int n, int *pfd, struct semaphore **ps)
+{
+  struct file *f;
+
+  if(argfd(n, pfd, &f) < 0 || f->type != FD_SEM)
+    return -1;
+  *ps = f->sem;
+  return 0;
+}
+
+// semopen(name, value): open the named semaphore, making it with the
+// given count if it doesn't exist yet, and return a descriptor for it.
+int
+sys_semopen(void)
+{
+  char name[MAXPATH];
+  int value, fd;
+  struct semaphore *s;
+  struct file *f;
+
+  if(argstr(0, name, sizeof(name)) < 0 || argint(1, &value) < 0)
+    return -1;
+  if((s = semopen(name, value)) == 0)
+    return -1;
+  if((f = filealloc()) == 0){
+    semclose(s);
+    return -1;
+  }
+  f->type = FD_SEM;
+  f->sem = s;
+  f->readable = 0;
+  f->writable = 0;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
+  return fd;
+}
+
+int
+sys_semwait(void)
+{
+  struct semaphore *s;
+
+  if(argsem(0, 0, &s) < 0)
+    return -1;
+  return semwait(s);
+}
+
+int
+sys_semtrywait(void)
+{
+  struct semaphore *s;
+
+  if(argsem(0, 0, &s) < 0)
+    return -1;
+  return semtrywait(s);
+}
+
+int
+sys_sempost(void)
+{
+  struct semaphore *s;
+
+  if(argsem(0, 0, &s) < 0)
+    return -1;
+  sempost(s);
+  return 0;
+}
+
+// Like close, but only for a semaphore descriptor.
+int
+sys_semclose(void)
+{
+  struct semaphore *s;
+  int fd;
+
+  if(argsem(0, &fd, &s) < 0)
+    return -1;
+  return closefd(fd);
+}
+
 int sys_changeconsmode(void){
 
     int mode;
@@ -459,8 +645,8 @@ int sys_mount(void){
 
     int result;
     int dev;
-    char *path;
-    if(argint(0, &dev) < 0 || argstr(1, &path) < 0 ){
+    char path[MAXPATH];
+    if(argint(0, &dev) < 0 || argstr(1, path, sizeof(path)) < 0 ){
         return -1;
     }
 
@@ -474,8 +660,8 @@ int sys_mount(void){
 
 int sys_umount(void){
     int result;
-    char *path;
-    if(argstr(0, &path) < 0){
+    char path[MAXPATH];
+    if(argstr(0, path, sizeof(path)) < 0){
         return -1;
     }
 
@@ -484,4 +670,97 @@ int sys_umount(void){
     }
     return 0;
 
-}
\ No newline at end of file
+}
+
+int
+sys_mmap(void)
+{
+  int addr, len, prot, flags, fd, off;
+  struct file *f;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argint(4, &fd) < 0 || argint(5, &off) < 0)
+    return -1;
+  f = 0;
+  if(!(flags & MAP_ANONYMOUS) && argfd(4, 0, &f) < 0)
+    return -1;
+  return mmap(addr, len, prot, flags, f, off);
+}
+
+int
+sys_munmap(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  return munmap(addr, len);
+}
+
+int
+sys_msync(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  return msync(addr, len);
+}
+
+// Run one submission queue entry for ringenter,
+// checking its pointers as the system call would.
+static int
+ringop(struct sqe *e)
+{
+  struct file *f;
+  char *p, path[MAXPATH];
+
+  switch(e->op){
+  case RING_NOP:
+    return 0;
+  case RING_READ:
+  case RING_WRITE:
+    if((f = fileget(e->fd)) == 0 || fetchptr(e->addr, &p, (int)e->len, e->op == RING_READ) < 0)
+      return -1;
+    if(e->op == RING_READ)
+      return fileread(f, p, e->len);
+    return filewrite(f, p, e->len);
+  case RING_OPEN:
+    if(fetchstr(e->addr, path, sizeof(path)) < 0)
+      return -1;
+    return openpath(path, e->len);
+  case RING_CLOSE:
+    return closefd(e->fd);
+  case RING_FSTAT:
+    if((f = fileget(e->fd)) == 0 || fetchptr(e->addr, &p, sizeof(struct stat), 1) < 0)
+      return -1;
+    return filestat(f, (struct stat*)p);
+  }
+  return -1;
+}
+
+// Run the operations queued on a ring (see ring.h), in order, posting
+// each result on the completion queue. One trap pays for the whole batch.
+// Stops when the submission queue is empty, the completion queue is full
+// or the process is killed. Returns the number of operations run.
+int
+sys_ringenter(void)
+{
+  struct ring *r;
+  struct sqe e;
+  int n;
+
+  if(argptrw(0, (char**)&r, sizeof(*r)) < 0)
+    return -1;
+  for(n = 0; n < RING_ENTRIES && r->sqhead != r->sqtail; n++){
+    if(r->cqtail - r->cqhead >= RING_ENTRIES || myproc()->killed)
+      break;
+    e = r->sq[r->sqhead % RING_ENTRIES];  // the process may reuse the slot once sqhead passes it
+    r->sqhead++;
+    r->cq[r->cqtail % RING_ENTRIES].data = e.data;
+    r->cq[r->cqtail % RING_ENTRIES].res = ringop(&e);
+    fileunhold(myproc());
+    r->cqtail++;
+  }
+  return n;
+}
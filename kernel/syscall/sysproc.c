@@ -6,7 +6,13 @@
 #include "../arch/x86_32/mem/memlayout.h"
 #include "../arch/x86_32/mem/mmu.h"
 #include "../lock/spinlock.h"
+#include "../lock/sleeplock.h"
 #include "../sched/proc.h"
+#include "../mm/vmspace.h"
+#include "../mm/memstat.h"
+#include "../lock/lockstat.h"
+#include "../data/counters.h"
+#include "../lock/futex.h"
 
 int
 sys_fork(void)
@@ -27,6 +33,39 @@ sys_wait(void)
   return wait();
 }
 
+// clone(fn, arg, stack): start a thread running fn(arg) on the
+// stack whose top is stack, see clone in proc.c.
+int
+sys_clone(void)
+{
+  int fn, arg, stack;
+  char *p;
+
+  if(argint(0, &fn) < 0 || argint(1, &arg) < 0 || argint(2, &stack) < 0)
+    return -1;
+  if(stack % 4 || fetchptr(stack - 8, &p, 8, 1) < 0)
+    return -1;
+  return clone((void(*)(void*))fn, (void*)arg, (void*)stack);
+}
+
+// join(&stack): reap a thread, handing back its stack.
+int
+sys_join(void)
+{
+  int addr, pid;
+  void *stack;
+  char *p;
+
+  if(argint(0, &addr) < 0 || fetchptr(addr, &p, sizeof(stack), 1) < 0)
+    return -1;
+  if((pid = join(&stack)) < 0)
+    return -1;
+  // another thread may have unmapped it while we waited
+  if(fetchptr(addr, &p, sizeof(stack), 1) == 0)
+    *(void**)p = stack;
+  return pid;
+}
+
 int
 sys_kill(void)
 {
@@ -48,20 +87,105 @@ sys_sbrk(void)
 {
   int addr;
   int n;
+  struct vmspace *vm;
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
+  vm = myproc()->vm;
+  acquiresleep(&vm->lock);
+  addr = vm->sz;
   if(growproc(n) < 0)
-    return -1;
+    addr = -1;
+  releasesleep(&vm->lock);
   return addr;
 }
+// Free pages, kept up to date by kalloc and kfree.
 int
 sys_freemem(void){
     int pages = freemem();
     return pages;
 }
 
+// Resident pages of a process, 0 means the caller.
+int
+sys_rss(void)
+{
+  int pid;
+
+  if(argint(0, &pid) < 0)
+    return -1;
+  if(pid == 0)
+    return myproc()->vm->rss;
+  return procrss(pid);
+}
+
+int
+sys_memstat(void)
+{
+  struct memstat *st;
+
+  if(argptrw(0, (char**)&st, sizeof(*st)) < 0)
+    return -1;
+  kmemstat(st);
+  return 0;
+}
+
+// Copy the lock contention counters into buf, n entries at most,
+// and return how many there were. A null buf starts them over.
+int
+sys_lockstat(void)
+{
+  struct lockstatent *buf;
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0)
+    return -1;
+  if(argint(0, (int*)&buf) < 0)
+    return -1;
+  if(buf == 0){
+    lockstatreset();
+    return 0;
+  }
+  if(n > NLOCKSTAT)
+    n = NLOCKSTAT;  // there are never more entries, and n*sizeof(*buf) must not wrap
+  if(argptrw(0, (char**)&buf, n*sizeof(*buf)) < 0)
+    return -1;
+  return lockstatread(buf, n);
+}
+
+// Copy the totals of up to n event counters into buf
+// and return how many counters there are.
+int
+sys_counters(void)
+{
+  uint32 *buf;
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0 || n > NCOUNTER)
+    return -1;
+  if(argptrw(0, (char**)&buf, n*sizeof(*buf)) < 0)
+    return -1;
+  return countread(buf, n);
+}
+
+// futex(addr, op, val): wait on or wake the int at addr, see lock/futex.h.
+int
+sys_futex(void)
+{
+  uint32 *addr;
+  int op, val;
+
+  if(argptrw(0, (char**)&addr, sizeof(*addr)) < 0 || argint(1, &op) < 0 || argint(2, &val) < 0)
+    return -1;
+  switch(op){
+  case FUTEX_WAIT:
+    return futexwait(addr, val);
+  case FUTEX_WAKE:
+    return val < 0 ? -1 : futexwake(addr, val);
+  }
+  return -1;
+}
+
 int
 sys_sig(void){
     int signal,pid;
@@ -130,3 +254,47 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// Create a shared memory segment and attach it,
+// returns the address it is mapped at.
+int
+sys_shmcreate(void)
+{
+  char name[MAXPATH];
+  int size, addr;
+  struct shm *s;
+
+  if(argstr(0, name, sizeof(name)) < 0 || argint(1, &size) < 0 || size <= 0)
+    return -1;
+  if((s = shmalloc(name, size)) == 0)
+    return -1;
+  if((addr = shmmap(s)) < 0)
+    shmput(s);
+  return addr;
+}
+
+int
+sys_shmattach(void)
+{
+  char name[MAXPATH];
+  int addr;
+  struct shm *s;
+
+  if(argstr(0, name, sizeof(name)) < 0)
+    return -1;
+  if((s = shmlookup(name)) == 0)
+    return -1;
+  if((addr = shmmap(s)) < 0)
+    shmput(s);
+  return addr;
+}
+
+int
+sys_shmdetach(void)
+{
+  int addr;
+
+  if(argint(0, &addr) < 0)
+    return -1;
+  return shmunmap(addr);
+}
@@ -9,9 +9,11 @@
 #include "../arch/x86_32/traps.h"
 #include "../sched/signals.h"
 #include "../sched/sched.h"
+#include "../data/counters.h"
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
 extern uint32 vectors[];  // in vectors.S: array of 256 entry pointers
+extern void sysentry(void);  // in trapasm.S
 struct spinlock tickslock;
 uint32 ticks;
 
@@ -30,6 +32,28 @@ idtinit(void) {
     lidt(idt, sizeof(idt));
 }
 
+// System calls from usys.S come in with sysenter rather than int $T_SYSCALL, which
+// skips the gate checks, the stack switch through the TSS and iret on the way out.
+// The CPU takes the kernel %eip and %esp from MSRs. %esp is pointed at the top of
+// this CPU's sysstack, which holds the address of ts.esp0; switchuvm keeps that at
+// the top of the running process's kernel stack, and sysentry loads its stack from
+// there. sysenter leaves FL_TF alone, so a user single-stepping into a system call
+// takes a debug trap before sysentry runs: sysstack is there for that trap frame
+// to land on. Runs on each CPU.
+void
+sysenterinit(void) {
+    struct cpu *c = mycpu();
+    uint32 eax, ebx, ecx, edx;
+
+    readcpuid(1, &eax, &ebx, &ecx, &edx);
+    if (!(edx & CPUID_EDX_SEP))
+        panic("sysenterinit: no sysenter");
+    wrmsr(MSR_SYSENTER_CS, SEG_KCODE << 3);
+    c->sysstack[NELEM(c->sysstack) - 1] = (uint32) &c->ts.esp0;
+    wrmsr(MSR_SYSENTER_ESP, (uint32) &c->sysstack[NELEM(c->sysstack) - 1]);
+    wrmsr(MSR_SYSENTER_EIP, (uint32) sysentry);
+}
+
 //PAGEBREAK: 41
 void
 trap(struct trapframe *tf) {
@@ -44,25 +68,35 @@ trap(struct trapframe *tf) {
     }
 
     switch (tf->trapno) {
-        case T_PGFLT:
-
+        case T_PGFLT: {
             uint32 addr = rcr2();
-            cprintf("Page Fault, offending address is %x \n",addr);
-            panic("PAGE FAULT");
-
-            /*
-            if(myproc() && addr < myproc()->sz && addr >= myproc()->stack_base - MAXSTACKSIZE){
-                // Check if the faulting address is within the stack growth range
-                uint32 newstacksize = PGROUNDUP(addr);
-                if(allocuvm(myproc()->pgdir, myproc()->stack_base - PGSIZE, newstacksize,0) == 0) {
-                    cprintf("allocuvm failed for stack growth\n");
-                    myproc()->p_sig |= SIGSEG;
-                } else {
-                    myproc()->stack_base = newstacksize; // Update the stack base
-                }
-                return;*/
-
 
+            countinc(CNT_PGFAULT);
+            if (myproc() && addr < KERNBASE) {
+                // The page may be out on the swap disk. Making room for it may take
+                // other pages of ours only if we came from user space.
+                if (swapin(myproc()->vm, addr, (tf->cs & 3) == DPL_USER) > 0)
+                    break;
+                // Faults below the stack grow it, up to MAXSTACKSIZE.
+                if (growstack(addr) == 0)
+                    break;
+                // mmap areas are filled in lazily on first touch.
+                if (mmapfault(addr, tf->err & FEC_WR) == 0)
+                    break;
+            }
+            // A user process touched memory it doesn't own (kernel memory included), or ran its
+            // stack into the guard page. SIGSEG cannot be ignored so the process is killed on its
+            // way back to user space.
+            if (myproc() && (tf->cs & 3) == DPL_USER) {
+                cprintf("pid %d %s: segmentation fault at 0x%x eip 0x%x\n",
+                        myproc()->pid, myproc()->name, addr, tf->eip);
+                myproc()->p_sig |= SIGSEG;
+                myproc()->killed = 1;
+                break;
+            }
+            cprintf("Page Fault, offending address is %x \n", addr);
+            panic("PAGE FAULT");
+        }
         case T_DBLFLT:
             panic("DOUBLE FAULT OCCURRED");
         case T_FPERR:
@@ -70,9 +104,11 @@ trap(struct trapframe *tf) {
         case T_GPFLT:
             panic("GENERAL PROTECTION FAULT");
         case T_IRQ0 + IRQ_TIMER:
+            countinc(CNT_TICK);
             if (cpuid() == 0) {
                 acquire(&tickslock);
                 ticks++;
+                vdatatick(ticks);
                 wakeup(&ticks);
                 release(&tickslock);
             }
@@ -95,6 +131,10 @@ trap(struct trapframe *tf) {
             uartintr();
             lapiceoi();
             break;
+        case T_TLBFLUSH:
+            tlbserve();
+            lapiceoi();
+            break;
         case T_IRQ0 + 7:
         case T_IRQ0 + IRQ_SPURIOUS:
             cprintf("cpu%d: spurious interrupt at %x:%x\n",
@@ -102,6 +142,16 @@ trap(struct trapframe *tf) {
             lapiceoi();
             break;
 
+        case T_DEBUG:
+            if ((tf->cs & 3) == 0) {
+                // FL_TF came in with sysenter (see sysenterinit). Nothing in the
+                // kernel single-steps: clear it and go back to sysentry, without
+                // the preemption below, as this frame is on the CPU's sysstack.
+                tf->eflags &= ~FL_TF;
+                return;
+            }
+            // in user space, same as below
+
             //PAGEBREAK: 13
         default:
             if (myproc() == 0 || (tf->cs & 3) == 0) {
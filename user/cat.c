@@ -9,6 +9,16 @@ cat(int fd)
 {
   int n;
 
+  // the kernel moves the data itself: sendfile from a file,
+  // splice from a pipe
+  while((n = sendfile(1, fd, -1, 65536)) > 0)
+    ;
+  if(n == 0)
+    return;
+  while((n = splice(fd, 1, 65536)) > 0)
+    ;
+  if(n == 0)
+    return;
   while((n = read(fd, buf, sizeof(buf))) > 0) {
     if (write(1, buf, n) != n) {
       printf(1, "cat: write error\n");
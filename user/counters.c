@@ -0,0 +1,30 @@
+// counters [ticks]: print the kernel's event counters, or with
+// ticks, how much each one went up over that many ticks.
+
+#include "types.h"
+#include "user.h"
+#include "../kernel/data/counters.h"
+
+char *names[] = COUNTERNAMES;
+
+int
+main(int argc, char *argv[])
+{
+  uint32 before[NCOUNTER], after[NCOUNTER];
+  int i, n;
+
+  if(counters(before, NCOUNTER) < 0){
+    printf(2, "counters: failed\n");
+    exit();
+  }
+  if(argc > 1 && (n = atoi(argv[1])) > 0){
+    sleep(n);
+    counters(after, NCOUNTER);
+    for(i = 0; i < NCOUNTER; i++)
+      printf(1, "%s\t%d\n", names[i], after[i] - before[i]);
+  } else {
+    for(i = 0; i < NCOUNTER; i++)
+      printf(1, "%s\t%d\n", names[i], before[i]);
+  }
+  exit();
+}
@@ -1,13 +1,21 @@
 //
 // Created by dustyn on 5/7/24.
 //
-#include "../kernel/syscall/syscall.h"
 #include "types.h"
 #include "user.h"
+#include "../kernel/mm/memstat.h"
 
 
 int main(){
-    int free_pages = freemem();
-    printf(1,"Pages allocated : %d which amounts to %d bytes\n",free_pages,free_pages * 4096);
+    struct memstat st;
+
+    if(memstat(&st) < 0){
+        printf(2,"freemem: memstat failed\n");
+        exit();
+    }
+    printf(1,"Free pages : %d (%d zeroed) of %d, which amounts to %d bytes\n",st.free,st.zeroed,st.total,st.free * 4096);
+    printf(1,"Used pages : %d user, %d page tables, %d kernel\n",st.user,st.pgtab,st.kernel);
+    if(st.swapsize)
+        printf(1,"Swap       : %d of %d pages used\n",st.swapped,st.swapsize);
     exit();
-};
\ No newline at end of file
+};
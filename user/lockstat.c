@@ -0,0 +1,60 @@
+// lockstat [n | -r]: print the n most contended locks (10 by default),
+// or reset the counters with -r. Cycles are shown in units of 1024.
+// For sleep locks, spun is how many waits spun on a running holder and
+// ok% how many of those got the lock without going to sleep.
+
+#include "types.h"
+#include "user.h"
+#include "../kernel/lock/lockstat.h"
+
+#define NENT 64
+
+struct lockstatent ent[NENT];
+
+// Does a go before b? Most contended first, then most time waited.
+static int
+before(struct lockstatent *a, struct lockstatent *b)
+{
+  if(a->ncontended != b->ncontended)
+    return a->ncontended > b->ncontended;
+  return a->waitcycles > b->waitcycles;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct lockstatent t;
+  int i, j, n, top;
+
+  if(argc > 1 && strcmp(argv[1], "-r") == 0){
+    if(lockstat(0, 0) < 0)
+      printf(2, "lockstat: reset failed\n");
+    exit();
+  }
+  top = argc > 1 ? atoi(argv[1]) : 10;
+  if((n = lockstat(ent, NENT)) < 0){
+    printf(2, "lockstat: failed\n");
+    exit();
+  }
+
+  for(i = 1; i < n; i++){
+    t = ent[i];
+    for(j = i; j > 0 && before(&t, &ent[j-1]); j--)
+      ent[j] = ent[j-1];
+    ent[j] = t;
+  }
+
+  printf(1, "name             type   acquired  contended  wait/1K  maxhold/1K  spun  ok%%\n");
+  for(i = 0; i < n && i < top; i++){
+    printf(1, "%s", ent[i].name);
+    for(j = strlen(ent[i].name); j < LOCKNAME + 1; j++)
+      printf(1, " ");
+    printf(1, "%s  %d  %d  %d  %d", ent[i].sleep ? "sleep" : "spin ",
+           ent[i].nacquire, ent[i].ncontended,
+           (uint32)(ent[i].waitcycles >> 10), (uint32)(ent[i].maxhold >> 10));
+    if(ent[i].nspin)
+      printf(1, "  %d  %d", ent[i].nspin, ent[i].nspinok * 100 / ent[i].nspin);
+    printf(1, "\n");
+  }
+  exit();
+}
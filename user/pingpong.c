@@ -0,0 +1,63 @@
+//
+// Context switch benchmark. Two processes bounce a byte back and forth over a
+// pair of pipes, so every round trip is two sleeps, two wakeups and two
+// switches between address spaces.
+//
+#include "types.h"
+#include "user.h"
+
+#define ROUNDS 20000
+
+static inline uint64
+rdtsc(void)
+{
+  uint32 lo, hi;
+
+  asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64)hi << 32) | lo;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int ping[2], pong[2], i, rounds, pid;
+  uint64 start, cycles;
+  uint32 t0;
+  char c;
+
+  rounds = argc > 1 ? atoi(argv[1]) : ROUNDS;
+  if(pipe(ping) < 0 || pipe(pong) < 0){
+    printf(2, "pingpong: pipe failed\n");
+    exit();
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf(2, "pingpong: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    for(i = 0; i < rounds; i++){
+      if(read(ping[0], &c, 1) != 1)
+        break;
+      write(pong[1], &c, 1);
+    }
+    exit();
+  }
+
+  t0 = uptime();
+  start = rdtsc();
+  for(i = 0; i < rounds; i++){
+    write(ping[1], "x", 1);
+    if(read(pong[0], &c, 1) != 1){
+      printf(2, "pingpong: read failed\n");
+      break;
+    }
+  }
+  cycles = rdtsc() - start;
+  wait();
+
+  printf(1, "%d round trips in %d ticks, %d cycles each\n",
+         rounds, uptime() - t0, (uint32)(cycles >> 4) / rounds * 16);
+  exit();
+}
@@ -0,0 +1,97 @@
+//
+// System call round trip benchmark. Asks for the pid, which costs the kernel
+// almost nothing, three ways: from the page the kernel maps at VPROC (ulib's
+// getpid), through the usys.S stub, which enters with sysenter, and the old
+// way with int $T_SYSCALL. Then compares fstat calls made one at a time
+// with the same calls queued RING_ENTRIES at a time for one ringenter.
+// Prints the cycles per call.
+//
+#include "types.h"
+#include "user.h"
+#include "stat.h"
+#include "../kernel/syscall/syscall.h"
+#include "../kernel/arch/x86_32/traps.h"
+#include "../kernel/syscall/ring.h"
+
+#define ROUNDS 100000
+
+static inline uint64
+rdtsc(void)
+{
+  uint32 lo, hi;
+
+  asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64)hi << 32) | lo;
+}
+
+static int
+intgetpid(void)
+{
+  int pid;
+
+  asm volatile("int %1" : "=a" (pid) : "i" (T_SYSCALL), "a" (SYS_getpid) : "memory");
+  return pid;
+}
+
+static void
+run(char *name, int (*call)(void))
+{
+  uint64 start, cycles;
+  int i;
+
+  call();
+  start = rdtsc();
+  for(i = 0; i < ROUNDS; i++)
+    call();
+  cycles = rdtsc() - start;
+  printf(1, "%s: %d cycles per call\n", name, (uint32)cycles / ROUNDS);
+}
+
+static struct stat st;
+static struct ring ring;
+
+static int
+fstat0(void)
+{
+  return fstat(0, &st);
+}
+
+static void
+runring(void)
+{
+  uint64 start, cycles;
+  int i, j;
+  struct sqe *e;
+
+  start = rdtsc();
+  for(i = 0; i < ROUNDS / RING_ENTRIES; i++){
+    for(j = 0; j < RING_ENTRIES; j++){
+      e = &ring.sq[ring.sqtail++ % RING_ENTRIES];
+      e->op = RING_FSTAT;
+      e->fd = 0;
+      e->addr = (uint32)&st;
+    }
+    if(ringenter(&ring) != RING_ENTRIES){
+      printf(2, "syscallbench: ringenter failed\n");
+      exit();
+    }
+    ring.cqhead = ring.cqtail;
+  }
+  cycles = rdtsc() - start;
+  printf(1, "fstat, ring: %d cycles per call\n", (uint32)cycles / (ROUNDS / RING_ENTRIES * RING_ENTRIES));
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(intgetpid() != getpid() || sysgetpid() != getpid()){
+    printf(2, "syscallbench: getpid differs\n");
+    exit();
+  }
+  run("vdata", getpid);
+  run("sysenter", sysgetpid);
+  run("int", intgetpid);
+  run("fstat", fstat0);
+  runring();
+  exit();
+}
@@ -0,0 +1,66 @@
+//
+// TLB miss benchmark. Touches one word per page of a 4MB area in a scattered
+// order, first with ordinary 4KB pages and then with a MAP_HUGE area that the
+// kernel backs with a single 4MB page. The 4KB run needs 1024 TLB entries to
+// cover the area, the 4MB run needs one.
+//
+#include "types.h"
+#include "user.h"
+#include "../kernel/mm/mman.h"
+
+#define AREA    (4 * 1024 * 1024)
+#define NPAGES  (AREA / 4096)
+#define ROUNDS  200
+
+static inline uint64
+rdtsc(void)
+{
+  uint32 lo, hi;
+
+  asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+  return ((uint64)hi << 32) | lo;
+}
+
+static uint64
+walk(char *p)
+{
+  uint64 start;
+  uint32 i, r, page;
+  volatile int sum = 0;
+
+  // warm up, this also faults every page in
+  for(i = 0; i < NPAGES; i++)
+    p[i * 4096] = i;
+
+  start = rdtsc();
+  for(r = 0; r < ROUNDS; r++){
+    // 521 is prime and coprime to NPAGES, so every page is visited once per round
+    for(i = 0, page = r; i < NPAGES; i++, page = (page + 521) % NPAGES)
+      sum += p[page * 4096 + (i & 63) * 4];
+  }
+  return rdtsc() - start;
+}
+
+static void
+run(char *name, int flags)
+{
+  char *p;
+  uint64 cycles;
+
+  p = mmap(0, AREA, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|flags, -1, 0);
+  if(p == MAP_FAILED){
+    printf(2, "tlbbench: mmap failed\n");
+    exit();
+  }
+  cycles = walk(p);
+  printf(1, "%s: %d cycles per access\n", name, (uint32)cycles / (ROUNDS * NPAGES));
+  munmap(p, AREA);
+}
+
+int
+main(int argc, char *argv[])
+{
+  run("4KB pages", 0);
+  run("4MB pages", MAP_HUGE);
+  exit();
+}
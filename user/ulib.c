@@ -3,6 +3,7 @@
 #include "../kernel/fs/xfcntl.h"
 #include "user.h"
 #include "../kernel/arch/x86_32/x86.h"
+#include "../kernel/mm/vdata.h"
 
 char*
 strcpy(char *s, const char *t)
@@ -105,3 +106,38 @@ memmove(void *vdst, const void *vsrc, int n)
   return vdst;
 }
 
+
+// getpid and uptime read the pages the kernel maps at VPROC and VDATA
+// instead of making system calls; sysgetpid and sysuptime still do.
+// Threads share VPROC, so once there are any getpid asks the kernel.
+int
+getpid(void)
+{
+  volatile struct vproc *v = (struct vproc*)VPROC;
+
+  if(v->threaded)
+    return sysgetpid();
+  return v->pid;
+}
+
+int
+uptime(void)
+{
+  return ((volatile struct vdata*)VDATA)->ticks;
+}
+
+// Nanoseconds since boot, from the TSC.
+// Always 0 if the kernel could not calibrate it.
+uint64
+uptimens(void)
+{
+  volatile struct vdata *vd = (struct vdata*)VDATA;
+  uint32 seq;
+  uint64 ns;
+
+  do {
+    seq = vd->seq;
+    ns = vd->ns + (((uint64)(uint32)(rdtsc() - vd->tsc) * vd->mult) >> VDATA_SHIFT);
+  } while((seq & 1) || seq != vd->seq);
+  return ns;
+}
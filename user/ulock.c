@@ -0,0 +1,140 @@
+// Mutexes and condition variables for processes sharing memory,
+// built on the futex system call.
+//
+// A mutex is 0 when free, 1 when held and 2 when held with someone
+// (maybe) waiting. Taking a free mutex and giving back one nobody
+// waits for are single atomic instructions, with no system call.
+// A condition variable counts its signals in seq, which waiters
+// sleep on, and only makes the system call to wake when it has
+// waiters.
+//
+// threadcreate and threadjoin start and reap threads, each on a
+// stack of its own from malloc.
+
+#include "types.h"
+#include "user.h"
+#include "../kernel/lock/futex.h"
+
+// Compare and swap: set *addr to new if it is old, and return
+// what *addr was.
+static inline int
+cas(volatile int *addr, int old, int new)
+{
+  return __sync_val_compare_and_swap(addr, old, new);
+}
+
+static inline int
+swap(volatile int *addr, int new)
+{
+  return __sync_lock_test_and_set(addr, new);
+}
+
+void
+mutexinit(struct mutex *m)
+{
+  m->state = 0;
+}
+
+// Returns 0 if the mutex was taken, -1 if it is held.
+int
+mutextrylock(struct mutex *m)
+{
+  return cas(&m->state, 0, 1) == 0 ? 0 : -1;
+}
+
+void
+mutexlock(struct mutex *m)
+{
+  int c;
+
+  if((c = cas(&m->state, 0, 1)) == 0)
+    return;
+  // Say there is a waiter before sleeping, so the holder wakes us.
+  // Once anyone has waited the mutex stays at 2 until it is free
+  // again, which at worst costs one wake with nobody to wake.
+  if(c != 2)
+    c = swap(&m->state, 2);
+  while(c != 0){
+    futex((int*)&m->state, FUTEX_WAIT, 2);
+    c = swap(&m->state, 2);
+  }
+}
+
+void
+mutexunlock(struct mutex *m)
+{
+  if(swap(&m->state, 0) == 2)
+    futex((int*)&m->state, FUTEX_WAKE, 1);
+}
+
+void
+condinit(struct cond *c)
+{
+  c->seq = 0;
+  c->waiters = 0;
+}
+
+// Give up m and sleep until signalled, then take m again. As with
+// any condition variable, check the condition again when it returns.
+void
+condwait(struct cond *c, struct mutex *m)
+{
+  int seq;
+
+  __sync_fetch_and_add(&c->waiters, 1);
+  seq = c->seq;
+  mutexunlock(m);
+  // a signal since reading seq changed it, and the wait returns at once
+  futex((int*)&c->seq, FUTEX_WAIT, seq);
+  __sync_fetch_and_sub(&c->waiters, 1);
+  // others may be asleep on m too: take it as contended
+  while(swap(&m->state, 2) != 0)
+    futex((int*)&m->state, FUTEX_WAIT, 2);
+}
+
+void
+condsignal(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  if(c->waiters)
+    futex((int*)&c->seq, FUTEX_WAKE, 1);
+}
+
+void
+condbroadcast(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  if(c->waiters)
+    futex((int*)&c->seq, FUTEX_WAKE, c->waiters);
+}
+
+#define TSTACK 4096  // bytes of stack for a thread
+
+// Start a thread running fn(arg), which must end with exit.
+// Returns its pid, or -1.
+int
+threadcreate(void (*fn)(void*), void *arg)
+{
+  char *stack;
+  int pid;
+
+  if((stack = malloc(TSTACK)) == 0)
+    return -1;
+  if((pid = clone(fn, arg, stack + TSTACK)) < 0)
+    free(stack);
+  return pid;
+}
+
+// Wait for a thread started by this one to exit, free its stack
+// and return its pid. Returns -1 if there are none.
+int
+threadjoin(void)
+{
+  void *stack;
+  int pid;
+
+  if((pid = join(&stack)) < 0)
+    return -1;
+  free((char*)stack - TSTACK);
+  return pid;
+}
@@ -5,6 +5,7 @@
 
 // Memory allocator by Kernighan and Ritchie,
 // The C programming Language, 2nd ed.  Section 8.7.
+// Threads share the free list, a mutex keeps them out of each other's way.
 
 typedef long Align;
 
@@ -20,9 +21,10 @@ typedef union header Header;
 
 static Header base;
 static Header *freep;
+static struct mutex lock;
 
-void
-free(void *ap)
+static void
+free1(void *ap)
 {
   Header *bp, *p;
 
@@ -43,6 +45,14 @@ free(void *ap)
   freep = p;
 }
 
+void
+free(void *ap)
+{
+  mutexlock(&lock);
+  free1(ap);
+  mutexunlock(&lock);
+}
+
 static Header*
 morecore(uint32 nu)
 {
@@ -56,7 +66,7 @@ morecore(uint32 nu)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  free1((void*)(hp + 1));
   return freep;
 }
 
@@ -67,6 +77,7 @@ malloc(uint32 nbytes)
   uint32 nunits;
 
   nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  mutexlock(&lock);
   if((prevp = freep) == 0){
     base.s.ptr = freep = prevp = &base;
     base.s.size = 0;
@@ -81,10 +92,13 @@ malloc(uint32 nbytes)
         p->s.size = nunits;
       }
       freep = prevp;
+      mutexunlock(&lock);
       return (void*)(p + 1);
     }
     if(p == freep)
-      if((p = morecore(nunits)) == 0)
+      if((p = morecore(nunits)) == 0){
+        mutexunlock(&lock);
         return 0;
+      }
   }
 }
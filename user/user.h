@@ -1,6 +1,9 @@
 #include "types.h"
 struct stat;
 struct rtcdate;
+struct memstat;
+struct ring;
+struct lockstatent;
 
 //Errors defined here as well
 #define ESIG                    1000000000    //Bad signal || no such signal
@@ -34,10 +37,10 @@ int link(const char*, const char*);
 int mkdir(const char*);
 int chdir(const char*);
 int dup(int);
-int getpid(void);
+int sysgetpid(void);
 char* sbrk(int);
 int sleep(int);
-int uptime(void);
+int sysuptime(void);
 int freemem(void);
 int sig(int, int);
 void sighandler(void (*));
@@ -45,6 +48,28 @@ void sigignore(int,int);
 void changeconsmode(int);
 int mount(int,char*);
 int umount(char*);
+void* mmap(void*, uint32, int, int, int, int);
+int munmap(void*, uint32);
+int msync(void*, uint32);
+void* shmcreate(char*, uint32);
+void* shmattach(char*);
+int shmdetach(void*);
+int rss(int);
+int memstat(struct memstat*);
+int ringenter(struct ring*);
+int lockstat(struct lockstatent*, int);
+int counters(uint32*, int);
+int futex(int*, int, int);
+int semopen(const char*, int);
+int semwait(int);
+int semtrywait(int);
+int sempost(int);
+int semclose(int);
+int clone(void(*)(void*), void*, void*);
+int join(void**);
+int splice(int, int, int);
+int vmsplice(int, void*, int);
+int sendfile(int, int, int, int);
 
 
 void stack_overflow(int x);
@@ -63,4 +88,26 @@ void* memset(void*, int, uint32);
 void* malloc(uint32);
 void free(void*);
 int atoi(const char*);
+int getpid(void);
+int uptime(void);
+uint64 uptimens(void);
+
+// ulock.c
+struct mutex {
+  volatile int state;
+};
+struct cond {
+  volatile int seq;
+  volatile int waiters;
+};
+void mutexinit(struct mutex*);
+void mutexlock(struct mutex*);
+int mutextrylock(struct mutex*);
+void mutexunlock(struct mutex*);
+void condinit(struct cond*);
+void condwait(struct cond*, struct mutex*);
+void condsignal(struct cond*);
+void condbroadcast(struct cond*);
+int threadcreate(void(*)(void*), void*);
+int threadjoin(void);
 
@@ -7,6 +7,13 @@
 #include "../kernel/syscall/syscall.h"
 #include "../kernel/arch/x86_32/traps.h"
 #include "../kernel/arch/x86_32/mem/memlayout.h"
+#include "../kernel/mm/mman.h"
+#include "../kernel/mm/memstat.h"
+#include "../kernel/mm/vdata.h"
+#include "../kernel/syscall/ring.h"
+#include "../kernel/lock/lockstat.h"
+#include "../kernel/data/counters.h"
+#include "../kernel/lock/futex.h"
 
 char buf[8192];
 char name[3];
@@ -354,6 +361,211 @@ pipe1(void)
   printf(1, "pipe1 ok\n");
 }
 
+// a pipe holds 64KB without a reader, in writes
+// and reads that straddle the pages of its ring
+void
+pipebig(void)
+{
+  int fds[2], seq, i, n, total;
+
+  printf(1, "pipebig test\n");
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  seq = 0;
+  for(total = 0; total < 65536; total += n){
+    n = 65536 - total < 1000 ? 65536 - total : 1000;
+    for(i = 0; i < n; i++)
+      buf[i] = seq++;
+    if(write(fds[1], buf, n) != n){
+      printf(1, "pipebig: write failed\n");
+      exit();
+    }
+  }
+  close(fds[1]);
+  seq = 0;
+  total = 0;
+  while((n = read(fds[0], buf, 3000)) > 0){
+    for(i = 0; i < n; i++){
+      if((buf[i] & 0xff) != (seq++ & 0xff)){
+        printf(1, "pipebig: wrong byte at %d\n", total + i);
+        exit();
+      }
+    }
+    total += n;
+  }
+  if(total != 65536){
+    printf(1, "pipebig: total %d\n", total);
+    exit();
+  }
+  close(fds[0]);
+  printf(1, "pipebig ok\n");
+}
+
+// splice moves data between files and pipes and from pipe to pipe,
+// vmsplice gives whole pages of the buffer to the pipe
+void
+splicetest(void)
+{
+  int fd, a[2], b[2], i, n, total;
+  char *mem, *pg;
+
+  printf(1, "splice test\n");
+  unlink("splicefile");
+  if((fd = open("splicefile", O_CREATE|O_RDWR)) < 0 || pipe(a) != 0 || pipe(b) != 0){
+    printf(1, "splice: open or pipe failed\n");
+    exit();
+  }
+  if(splice(fd, fd, 10) != -1 || splice(a[1], b[1], 10) != -1 || splice(a[0], a[1], 10) != -1 ||
+     vmsplice(fd, buf, 10) != -1){
+    printf(1, "splice: bad arguments not caught\n");
+    exit();
+  }
+  for(i = 0; i < 6000; i++)
+    buf[i] = i;
+  if(write(fd, buf, 6000) != 6000){
+    printf(1, "splice: write failed\n");
+    exit();
+  }
+  close(fd);
+
+  // file -> pipe a -> pipe b -> file
+  fd = open("splicefile", 0);
+  if(splice(fd, a[1], 100000) != 6000 || splice(fd, a[1], 10) != 0){
+    printf(1, "splice: file to pipe\n");
+    exit();
+  }
+  close(fd);
+  close(a[1]);
+  if(splice(a[0], b[1], 100000) != 6000 || splice(a[0], b[1], 10) != 0){
+    printf(1, "splice: pipe to pipe\n");
+    exit();
+  }
+  close(a[0]);
+  unlink("splicefile");
+  fd = open("splicefile", O_CREATE|O_RDWR);
+  if(splice(b[0], fd, 100000) != 6000){
+    printf(1, "splice: pipe to file\n");
+    exit();
+  }
+  close(fd);
+  fd = open("splicefile", 0);
+  memset(buf, 0, sizeof(buf));
+  if(read(fd, buf, sizeof(buf)) != 6000){
+    printf(1, "splice: file size wrong\n");
+    exit();
+  }
+  for(i = 0; i < 6000; i++){
+    if((buf[i] & 0xff) != (i & 0xff)){
+      printf(1, "splice: wrong byte at %d\n", i);
+      exit();
+    }
+  }
+  close(fd);
+  unlink("splicefile");
+
+  close(b[0]);
+  close(b[1]);
+
+  // the buffer's middle page lines up with a page of the
+  // ring, so it goes to the pipe whole
+  mem = sbrk(4 * 4096);
+  pg = (char*)(((uint32)mem + 4095) & ~4095);
+  for(i = 0; i < 3 * 4096; i++)
+    pg[i] = i % 251;
+  if(pipe(a) != 0 || write(a[1], pg, 100) != 100 ||
+     vmsplice(a[1], pg + 100, 3 * 4096 - 200) != 3 * 4096 - 200){
+    printf(1, "splice: vmsplice failed\n");
+    exit();
+  }
+  for(total = 0; total < 3 * 4096 - 100; total += n){
+    if((n = read(a[0], buf, sizeof(buf))) <= 0){
+      printf(1, "splice: short read after vmsplice\n");
+      exit();
+    }
+    for(i = 0; i < n; i++){
+      if((buf[i] & 0xff) != (total + i) % 251){
+        printf(1, "splice: vmsplice wrong byte at %d\n", total + i);
+        exit();
+      }
+    }
+  }
+  if(pg[4096] != 0 || pg[2 * 4096 - 1] != 0 || (pg[2 * 4096] & 0xff) != 4096 * 2 % 251){
+    printf(1, "splice: page not handed over\n");
+    exit();
+  }
+  close(a[0]);
+  close(a[1]);
+  sbrk(-4 * 4096);
+  printf(1, "splice test ok\n");
+}
+
+// sendfile copies a file to a file or pipe, from a given offset
+// or from the file's own
+void
+sendfiletest(void)
+{
+  int in, out, fds[2], i, n;
+
+  printf(1, "sendfile test\n");
+  unlink("sendin");
+  unlink("sendout");
+  in = open("sendin", O_CREATE|O_RDWR);
+  out = open("sendout", O_CREATE|O_RDWR);
+  if(in < 0 || out < 0 || pipe(fds) != 0){
+    printf(1, "sendfile: open or pipe failed\n");
+    exit();
+  }
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = i % 253;
+  if(write(in, buf, sizeof(buf)) != sizeof(buf)){
+    printf(1, "sendfile: write failed\n");
+    exit();
+  }
+  if(sendfile(out, fds[0], 0, 10) != -1 || sendfile(fds[0], in, 0, 10) != -1 ||
+     sendfile(out, in, 0, -1) != -1){
+    printf(1, "sendfile: bad arguments not caught\n");
+    exit();
+  }
+
+  // in's offset is at its end, a given offset leaves it there
+  if(sendfile(out, in, -1, 100) != 0 || sendfile(out, in, 1000, 100000) != sizeof(buf) - 1000 ||
+     sendfile(out, in, -1, 100) != 0 || sendfile(out, in, sizeof(buf) + 4096, 100) != 0){
+    printf(1, "sendfile: file to file\n");
+    exit();
+  }
+  if(sendfile(fds[1], in, 0, 3000) != 3000){
+    printf(1, "sendfile: file to pipe\n");
+    exit();
+  }
+  close(in);
+  close(fds[1]);
+
+  close(out);
+  out = open("sendout", 0);
+  memset(buf, 0, sizeof(buf));
+  if((n = read(out, buf, sizeof(buf))) != sizeof(buf) - 1000){
+    printf(1, "sendfile: output size %d\n", n);
+    exit();
+  }
+  for(i = 0; i < n; i++){
+    if((buf[i] & 0xff) != (i + 1000) % 253){
+      printf(1, "sendfile: wrong byte at %d\n", i);
+      exit();
+    }
+  }
+  close(out);
+  if(read(fds[0], buf, sizeof(buf)) != 3000 || (buf[2999] & 0xff) != 2999 % 253){
+    printf(1, "sendfile: pipe got the wrong bytes\n");
+    exit();
+  }
+  close(fds[0]);
+  unlink("sendin");
+  unlink("sendout");
+  printf(1, "sendfile test ok\n");
+}
+
 // meant to be run w/ at most two CPUs
 void
 preempt(void)
@@ -512,6 +724,78 @@ sharedfd(void)
   }
 }
 
+// several processes read the same file and look up paths through the
+// same directory at once, while another creates files in it
+void
+sharedreads(void)
+{
+  int fd, pid, i, j, k, n, pi;
+  char name[3];
+
+  printf(1, "sharedreads test\n");
+  fd = open("sr", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf(1, "sharedreads: create failed\n");
+    exit();
+  }
+  for(i = 0; i < 20; i++){
+    memset(buf, 'a' + i, 512);
+    if(write(fd, buf, 512) != 512){
+      printf(1, "sharedreads: write failed\n");
+      exit();
+    }
+  }
+  close(fd);
+
+  for(pi = 0; pi < 5; pi++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if(pid == 0 && pi == 4){
+      name[0] = 's';
+      name[2] = 0;
+      for(i = 0; i < 20; i++){
+        name[1] = 'a' + i;
+        if((fd = open(name, O_CREATE | O_RDWR)) < 0){
+          printf(1, "sharedreads: create %s failed\n", name);
+          exit();
+        }
+        close(fd);
+        unlink(name);
+      }
+      exit();
+    }
+    if(pid == 0){
+      for(k = 0; k < 5; k++){
+        if((fd = open("sr", 0)) < 0){
+          printf(1, "sharedreads: open failed\n");
+          exit();
+        }
+        for(i = 0; (n = read(fd, buf, 512)) > 0; i++){
+          for(j = 0; j < n; j++){
+            if(buf[j] != 'a' + i){
+              printf(1, "sharedreads: wrong char\n");
+              exit();
+            }
+          }
+        }
+        close(fd);
+        if(i != 20){
+          printf(1, "sharedreads: read %d blocks\n", i);
+          exit();
+        }
+      }
+      exit();
+    }
+  }
+  for(pi = 0; pi < 5; pi++)
+    wait();
+  unlink("sr");
+  printf(1, "sharedreads ok\n");
+}
+
 // four processes write different files at the same
 // time, to test block allocation.
 void
@@ -1546,6 +1830,900 @@ sbrktest(void)
   printf(stdout, "sbrk test OK\n");
 }
 
+// Recurse x levels deep with a 1KB frame at each level.
+void
+stack_overflow2(int x)
+{
+  volatile char buf[1024];
+
+  buf[0] = x;
+  buf[sizeof(buf)-1] = x;
+  if(x > 0)
+    stack_overflow2(x - 1);
+  if(buf[0] != (char)x || buf[sizeof(buf)-1] != (char)x){
+    printf(stdout, "stack frame corrupted at depth %d\n", x);
+    exit();
+  }
+}
+
+// Recurse until the stack runs into the guard page.
+void
+stack_overflow(int x)
+{
+  volatile char buf[1024];
+
+  buf[0] = x;
+  if(x < 1000000)
+    stack_overflow(x + 1);
+  buf[1] = buf[0];
+}
+
+// The stack starts at one page and grows on fault up to
+// MAXSTACKSIZE, past that the process gets SIGSEG.
+void
+stackgrowtest(void)
+{
+  int pid;
+
+  printf(stdout, "stack grow test\n");
+
+  // about 1.5MB deep, well past the first stack page
+  stack_overflow2(1500);
+
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    stack_overflow(0);
+    printf(stdout, "stack grow test failed: overflow not caught\n");
+    exit();
+  }
+  wait();
+  printf(stdout, "stack grow test OK\n");
+}
+
+// Private and shared file mappings, anonymous memory,
+// and mappings inherited across fork.
+void
+mmaptest(void)
+{
+  int fd, i, pid;
+  char *p, *q, buf[16];
+
+  printf(stdout, "mmap test\n");
+
+  unlink("mmapfile");
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "mmap test: create failed\n");
+    exit();
+  }
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = 'a' + i;
+  for(i = 0; i < 3*4096/sizeof(buf); i++)
+    write(fd, buf, sizeof(buf));
+
+  p = mmap(0, 3*4096, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED || p[0] != 'a' || p[2*4096+17] != 'b'){
+    printf(stdout, "mmap test: private map failed\n");
+    exit();
+  }
+  p[0] = 'X';
+  if(munmap(p, 3*4096) < 0){
+    printf(stdout, "mmap test: munmap failed\n");
+    exit();
+  }
+
+  q = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 4096);
+  if(q == MAP_FAILED || q[1] != 'b'){
+    printf(stdout, "mmap test: shared map failed\n");
+    exit();
+  }
+  q[0] = 'Y';
+  if(msync(q, 4096) < 0 || munmap(q, 4096) < 0){
+    printf(stdout, "mmap test: msync failed\n");
+    exit();
+  }
+  close(fd);
+
+  // private writes stay private, shared writes reach the file
+  fd = open("mmapfile", O_RDONLY);
+  read(fd, buf, 1);
+  if(buf[0] != 'a'){
+    printf(stdout, "mmap test: private write leaked\n");
+    exit();
+  }
+  for(i = 0; i < 4096/sizeof(buf); i++)
+    read(fd, buf, sizeof(buf));
+  read(fd, buf, 1);
+  if(buf[0] != 'Y'){
+    printf(stdout, "mmap test: shared write lost\n");
+    exit();
+  }
+
+  // a read-only mapping can't be the target of read()
+  p = mmap(0, 4096, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED || read(fd, p, 1) >= 0){
+    printf(stdout, "mmap test: read into PROT_READ map\n");
+    exit();
+  }
+  munmap(p, 4096);
+  close(fd);
+  unlink("mmapfile");
+
+  p = mmap(0, 8*4096, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED || p[5*4096] != 0){
+    printf(stdout, "mmap test: anonymous map failed\n");
+    exit();
+  }
+  p[5*4096] = 42;
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(p[5*4096] != 42){
+      printf(stdout, "mmap test: child lost mapping\n");
+      exit();
+    }
+    p[5*4096] = 7;
+    exit();
+  }
+  wait();
+  if(p[5*4096] != 42){
+    printf(stdout, "mmap test: child write leaked\n");
+    exit();
+  }
+  // punch a hole, then the tail must still be there
+  if(munmap(p + 4096, 4096) < 0 || p[5*4096] != 42 || munmap(p, 8*4096) < 0){
+    printf(stdout, "mmap test: partial munmap failed\n");
+    exit();
+  }
+
+  // shared anonymous memory: the child writes the parent's page
+  p = mmap(0, 2*4096, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED || p[4096] != 0){
+    printf(stdout, "mmap test: shared anonymous map failed\n");
+    exit();
+  }
+  p[4096] = 42;
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(p[4096] == 42)
+      p[4096] = 7;
+    exit();
+  }
+  wait();
+  if(p[4096] != 7){
+    printf(stdout, "mmap test: child write not shared\n");
+    exit();
+  }
+  if(munmap(p, 4096) != -1 || munmap(p, 2*4096) < 0){
+    printf(stdout, "mmap test: shared anonymous munmap failed\n");
+    exit();
+  }
+
+  // 4MB pages: aligned, copied on fork, never split by munmap
+  p = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGE, -1, 0);
+  if(p == MAP_FAILED || (uint32)p % (4*1024*1024) != 0){
+    printf(stdout, "mmap test: huge map failed\n");
+    exit();
+  }
+  p[3*1024*1024] = 9;
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(p[3*1024*1024] != 9)
+      printf(stdout, "mmap test: child lost huge page\n");
+    exit();
+  }
+  wait();
+  if(munmap(p, 4096) >= 0 || munmap(p, 4*1024*1024) < 0){
+    printf(stdout, "mmap test: huge munmap failed\n");
+    exit();
+  }
+  printf(stdout, "mmap test OK\n");
+}
+
+// Segments are shared by name and across fork, and
+// stay around until the last process detaches.
+void
+shmtest(void)
+{
+  char *p, *q;
+  int pid;
+
+  printf(stdout, "shm test\n");
+
+  p = shmcreate("shmtest", 2*4096);
+  if(p == (char*)-1 || p[4096] != 0){
+    printf(stdout, "shm test: create failed\n");
+    exit();
+  }
+  if(shmcreate("shmtest", 4096) != (char*)-1){
+    printf(stdout, "shm test: duplicate name allowed\n");
+    exit();
+  }
+  p[4096] = 'a';
+
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    q = shmattach("shmtest");
+    if(q == (char*)-1 || q == p || q[4096] != 'a' || p[4096] != 'a'){
+      printf(stdout, "shm test: child attach failed\n");
+      exit();
+    }
+    q[0] = 'b';
+    shmdetach(q);
+    // the parent's segment is still attached through fork
+    p[1] = 'c';
+    exit();
+  }
+  wait();
+  if(p[0] != 'b' || p[1] != 'c'){
+    printf(stdout, "shm test: child writes not seen\n");
+    exit();
+  }
+  if(munmap(p, 4096) >= 0 || shmdetach(p + 4096) >= 0){
+    printf(stdout, "shm test: partial detach allowed\n");
+    exit();
+  }
+  if(shmdetach(p) < 0 || shmattach("shmtest") != (char*)-1){
+    printf(stdout, "shm test: segment outlived last detach\n");
+    exit();
+  }
+  printf(stdout, "shm test OK\n");
+}
+
+// The page counters follow sbrk and mmap without a page table walk.
+void
+rsstest(void)
+{
+  struct memstat st0, st1;
+  int r0;
+  char *p;
+
+  printf(stdout, "rss test\n");
+  r0 = rss(0);
+  if(r0 <= 0 || rss(getpid()) != r0 || memstat(&st0) < 0){
+    printf(stdout, "rss test: bad counters\n");
+    exit();
+  }
+  sbrk(10*4096);
+  p = mmap(0, 4*4096, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  p[0] = p[3*4096] = 1;
+  memstat(&st1);
+  if(rss(0) != r0 + 12 || st1.user < st0.user + 12 || st1.free + st1.user + st1.pgtab + st1.kernel != st1.total){
+    printf(stdout, "rss test: counters didn't follow, rss %d -> %d\n", r0, rss(0));
+    exit();
+  }
+  munmap(p, 4*4096);
+  sbrk(-10*4096);
+  if(rss(0) != r0){
+    printf(stdout, "rss test: rss %d after unmap, want %d\n", rss(0), r0);
+    exit();
+  }
+  printf(stdout, "rss test OK\n");
+}
+
+// Touch more memory than there is, so that pages go out to the
+// swap disk and come back when they are read.
+void
+swaptest(void)
+{
+  struct memstat st;
+  char *base;
+  int i, n, pid, swapped;
+
+  printf(stdout, "swap test\n");
+  memstat(&st);
+  if(st.swapsize == 0){
+    printf(stdout, "swap test: no swap disk, skipped\n");
+    return;
+  }
+  n = st.free + st.swapsize / 2;
+  base = sbrk(0);
+  for(i = 0; i < n; i++){
+    if((i % 64) == 0 && sbrk(64*4096) == (char*)-1){
+      printf(stdout, "swap test: sbrk failed after %d pages\n", i);
+      exit();
+    }
+    *(int*)(base + i*4096) = i;
+  }
+  memstat(&st);
+  swapped = st.swapped;
+  if(swapped == 0){
+    printf(stdout, "swap test: nothing was swapped\n");
+    exit();
+  }
+  for(i = 0; i < n; i++){
+    if(*(int*)(base + i*4096) != i){
+      printf(stdout, "swap test: page %d lost its contents\n", i);
+      exit();
+    }
+  }
+
+  // a child gets copies of pages that are out on the disk
+  sbrk(-(n - 64)*4096);
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "swap test: fork failed\n");
+    exit();
+  }
+  for(i = 0; i < 64; i++){
+    if(*(int*)(base + i*4096) != i){
+      printf(stdout, "swap test: page %d wrong in %s\n", i, pid ? "parent" : "child");
+      exit();
+    }
+  }
+  if(pid == 0)
+    exit();
+  wait();
+  sbrk(-64*4096);
+  memstat(&st);
+  if(st.swapped >= swapped){
+    printf(stdout, "swap test: slots not freed, %d of %d still used\n", st.swapped, swapped);
+    exit();
+  }
+  printf(stdout, "swap test OK\n");
+}
+
+// getpid, uptime and uptimens read pages the kernel maps read-only
+// into every process; they must agree with the system calls.
+void
+vdatatest(void)
+{
+  uint64 ns0, ns1;
+  int pid, t;
+
+  printf(stdout, "vdata test\n");
+  t = sysuptime();
+  if(getpid() != sysgetpid() || uptime() < t || uptime() > t + 1){
+    printf(stdout, "vdata test: pid %d/%d, ticks %d/%d\n", getpid(), sysgetpid(), uptime(), t);
+    exit();
+  }
+  ns0 = uptimens();
+  sleep(2);
+  ns1 = uptimens();
+  if(ns1 < ns0 || (ns0 != 0 && ns1 == ns0)){
+    printf(stdout, "vdata test: clock didn't move forward\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "vdata test: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(getpid() != sysgetpid()){
+      printf(stdout, "vdata test: child sees pid %d\n", getpid());
+      exit();
+    }
+    *(int*)VDATA = 0;  // read-only, this kills us
+    printf(stdout, "vdata test: wrote to VDATA\n");
+    exit();
+  }
+  wait();
+  if(getpid() != sysgetpid()){
+    printf(stdout, "vdata test: parent pid changed\n");
+    exit();
+  }
+  printf(stdout, "vdata test OK\n");
+}
+
+static struct ring ring;
+
+static void
+ringqueue(uint32 op, int fd, void *addr, uint32 len, uint32 data)
+{
+  struct sqe *e = &ring.sq[ring.sqtail % RING_ENTRIES];
+
+  e->op = op;
+  e->fd = fd;
+  e->addr = (uint32)addr;
+  e->len = len;
+  e->data = data;
+  ring.sqtail++;
+}
+
+// Result of the next completion, which must carry data.
+static int
+ringresult(uint32 data)
+{
+  struct cqe *c;
+
+  if(ring.cqhead == ring.cqtail){
+    printf(stdout, "ring test: no completion for %d\n", data);
+    exit();
+  }
+  c = &ring.cq[ring.cqhead++ % RING_ENTRIES];
+  if(c->data != data){
+    printf(stdout, "ring test: completion %d out of order, want %d\n", c->data, data);
+    exit();
+  }
+  return c->res;
+}
+
+// Batches of file and pipe operations through ringenter.
+void
+ringtest(void)
+{
+  char buf[16];
+  struct stat st;
+  int fds[2], fd, i;
+
+  printf(stdout, "ring test\n");
+  if(pipe(fds) < 0){
+    printf(stdout, "ring test: pipe failed\n");
+    exit();
+  }
+  ringqueue(RING_WRITE, fds[1], "ring", 4, 1);
+  ringqueue(RING_READ, fds[0], buf, sizeof(buf), 2);
+  ringqueue(RING_OPEN, 0, "ringfile", O_CREATE|O_RDWR, 3);
+  ringqueue(RING_NOP, 0, 0, 0, 4);
+  ringqueue(99, 0, 0, 0, 5);
+  ringqueue(RING_READ, NOFILE, buf, 1, 6);
+  ringqueue(RING_WRITE, fds[1], (void*)KERNBASE, 1, 7);
+  if(ringenter(&ring) != 7 || ring.sqhead != 7){
+    printf(stdout, "ring test: first batch not run\n");
+    exit();
+  }
+  buf[4] = 0;
+  if(ringresult(1) != 4 || ringresult(2) != 4 || strcmp(buf, "ring") != 0){
+    printf(stdout, "ring test: pipe round trip failed\n");
+    exit();
+  }
+  if((fd = ringresult(3)) < 0 || ringresult(4) != 0 ||
+     ringresult(5) != -1 || ringresult(6) != -1 || ringresult(7) != -1){
+    printf(stdout, "ring test: bad results\n");
+    exit();
+  }
+
+  // with completions left unread, a batch stops when the completion queue is full
+  for(i = 0; i < 8; i++)
+    ringqueue(RING_NOP, 0, 0, 0, 50 + i);
+  for(i = 0; i < RING_ENTRIES - 8; i++)
+    ringqueue(RING_WRITE, fd, "0123456789", 10, 100 + i);
+  ringenter(&ring);
+  for(; i < RING_ENTRIES; i++)
+    ringqueue(RING_WRITE, fd, "0123456789", 10, 100 + i);
+  if(ringenter(&ring) != 0){
+    printf(stdout, "ring test: ran past a full completion queue\n");
+    exit();
+  }
+  for(i = 0; i < 8; i++)
+    ringresult(50 + i);
+  if(ringenter(&ring) != 8){
+    printf(stdout, "ring test: rest of the batch not run\n");
+    exit();
+  }
+  for(i = 0; i < RING_ENTRIES; i++){
+    if(ringresult(100 + i) != 10){
+      printf(stdout, "ring test: write %d failed\n", i);
+      exit();
+    }
+  }
+  ringqueue(RING_FSTAT, fd, &st, 0, 200);
+  ringqueue(RING_CLOSE, fd, 0, 0, 201);
+  if(ringenter(&ring) != 2 || ringresult(200) != 0 || st.size != 10 * RING_ENTRIES || ringresult(201) != 0){
+    printf(stdout, "ring test: fstat or close failed, size %d\n", st.size);
+    exit();
+  }
+  if(close(fd) >= 0){
+    printf(stdout, "ring test: fd still open\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+  unlink("ringfile");
+  printf(stdout, "ring test OK\n");
+}
+
+// pids are found without scanning the process table, and a
+// reaped process can't be found any more, even while its slot waits
+// to be reused
+void
+pidtest(void)
+{
+  int pids[20], i, pid;
+
+  printf(stdout, "pid test\n");
+  for(i = 0; i < 20; i++){
+    if((pids[i] = fork()) < 0){
+      printf(stdout, "pid test: fork failed\n");
+      exit();
+    }
+    if(pids[i] == 0){
+      sleep(1000);
+      exit();
+    }
+  }
+  for(i = 0; i < 20; i++){
+    if(rss(pids[i]) <= 0){
+      printf(stdout, "pid test: child %d not found\n", pids[i]);
+      exit();
+    }
+  }
+  for(i = 0; i < 20; i++)
+    kill(pids[i]);
+  for(i = 0; i < 20; i++)
+    wait();
+  for(i = 0; i < 20; i++){
+    if((pid = pids[i]) == getpid())
+      continue;
+    if(rss(pid) >= 0 && kill(pid) >= 0){
+      printf(stdout, "pid test: reaped child %d still found\n", pid);
+      exit();
+    }
+  }
+  if(kill(-1) != -1 || rss(-5) != -1){
+    printf(stdout, "pid test: bad pid found\n");
+    exit();
+  }
+  printf(stdout, "pid test OK\n");
+}
+
+// the event counters go up with what they count
+void
+countertest(void)
+{
+  uint32 c0[NCOUNTER], c1[NCOUNTER];
+  int i;
+
+  printf(stdout, "counter test\n");
+  if(counters(c0, NCOUNTER) != NCOUNTER || counters(c0, NCOUNTER + 1) != -1 ||
+     counters((uint32*)KERNBASE, 1) != -1){
+    printf(stdout, "counter test: bad arguments\n");
+    exit();
+  }
+  for(i = 0; i < 100; i++)
+    kill(-1);
+  sbrk(4096);
+  sbrk(-4096);
+  sleep(2);
+  counters(c1, NCOUNTER);
+  if(c1[CNT_SYSCALL] - c0[CNT_SYSCALL] < 100 || c1[CNT_TICK] == c0[CNT_TICK] ||
+     c1[CNT_SWITCH] == c0[CNT_SWITCH] || c1[CNT_KALLOC] == c0[CNT_KALLOC] ||
+     c1[CNT_KFREE] == c0[CNT_KFREE]){
+    printf(stdout, "counter test: counters didn't move\n");
+    exit();
+  }
+  printf(stdout, "counter test OK\n");
+}
+
+// A mutex and condition variable in shared memory hold up across
+// processes, and taking a free mutex makes no system call.
+void
+futextest(void)
+{
+  struct {
+    struct mutex m;
+    struct cond c;
+    int n, ready;
+  } *s;
+  uint32 c0[NCOUNTER], c1[NCOUNTER];
+  int i, j, pid;
+
+  printf(stdout, "futex test\n");
+  s = shmcreate("futextest", 4096);
+  if(s == (void*)-1){
+    printf(stdout, "futex test: shmcreate failed\n");
+    exit();
+  }
+  mutexinit(&s->m);
+  condinit(&s->c);
+  if(futex(&s->n, FUTEX_WAIT, 1) != -1 || futex(&s->n, FUTEX_WAKE, 1) != 0 ||
+     futex(&s->n, 7, 0) != -1 || futex((int*)((char*)&s->n + 1), FUTEX_WAKE, 1) != -1 ||
+     futex((int*)KERNBASE, FUTEX_WAKE, 1) != -1){
+    printf(stdout, "futex test: bad arguments not caught\n");
+    exit();
+  }
+
+  counters(c0, NCOUNTER);
+  for(i = 0; i < 1000; i++){
+    mutexlock(&s->m);
+    mutexunlock(&s->m);
+  }
+  counters(c1, NCOUNTER);
+  if(c1[CNT_SYSCALL] - c0[CNT_SYSCALL] > 10){
+    printf(stdout, "futex test: uncontended mutex made system calls\n");
+    exit();
+  }
+
+  for(i = 0; i < 4; i++){
+    if((pid = fork()) < 0){
+      printf(stdout, "fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      for(j = 0; j < 500; j++){
+        mutexlock(&s->m);
+        s->n++;
+        mutexunlock(&s->m);
+      }
+      exit();
+    }
+  }
+  for(i = 0; i < 4; i++)
+    wait();
+  if(s->n != 2000){
+    printf(stdout, "futex test: lost updates, n = %d\n", s->n);
+    exit();
+  }
+
+  if((pid = fork()) < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    mutexlock(&s->m);
+    while(!s->ready)
+      condwait(&s->c, &s->m);
+    s->n = 0;
+    mutexunlock(&s->m);
+    exit();
+  }
+  sleep(2);
+  mutexlock(&s->m);
+  s->ready = 1;
+  condsignal(&s->c);
+  mutexunlock(&s->m);
+  wait();
+  if(s->n != 0){
+    printf(stdout, "futex test: condwait didn't return\n");
+    exit();
+  }
+  shmdetach(s);
+  printf(stdout, "futex test OK\n");
+}
+
+// Named semaphores are shared by name and across fork, and a post
+// goes to the process that has waited longest.
+void
+semtest(void)
+{
+  int sd, sd2, pfd[2], pids[3], i, pid;
+
+  printf(stdout, "sem test\n");
+  if(semopen("", 1) != -1 || semopen("semtest", -1) != -1 || pipe(pfd) < 0 ||
+     semwait(pfd[0]) != -1 || semclose(pfd[0]) != -1){
+    printf(stdout, "sem test: bad arguments not caught\n");
+    exit();
+  }
+  close(pfd[0]);
+  close(pfd[1]);
+  if((sd = semopen("semtest", 0)) < 0 || (sd2 = semopen("semtest", 5)) < 0){
+    printf(stdout, "sem test: semopen failed\n");
+    exit();
+  }
+  if(semtrywait(sd) != -1 || sempost(sd2) != 0 || semtrywait(sd) != 0 || semtrywait(sd2) != -1){
+    printf(stdout, "sem test: count wrong\n");
+    exit();
+  }
+
+  // queue three waiters, one after the other
+  for(i = 0; i < 3; i++){
+    if((pids[i] = fork()) < 0){
+      printf(stdout, "fork failed\n");
+      exit();
+    }
+    if(pids[i] == 0){
+      semwait(sd);
+      exit();
+    }
+    sleep(2);
+  }
+  for(i = 0; i < 3; i++){
+    sempost(sd);
+    if((pid = wait()) != pids[i]){
+      printf(stdout, "sem test: waiter %d went before %d\n", pid, pids[i]);
+      exit();
+    }
+  }
+  if(semtrywait(sd) != -1){
+    printf(stdout, "sem test: handed off count left behind\n");
+    exit();
+  }
+  semclose(sd);
+  semclose(sd2);
+  if((sd = semopen("semtest", 1)) < 0 || semtrywait(sd) != 0){
+    printf(stdout, "sem test: semaphore outlived its last close\n");
+    exit();
+  }
+  semclose(sd);
+  printf(stdout, "sem test OK\n");
+}
+
+struct {
+  struct mutex m;
+  int n;
+  int fd;
+} tshared;
+
+static void
+threadwork(void *arg)
+{
+  char *p;
+  int i;
+
+  for(i = 0; i < 500; i++){
+    mutexlock(&tshared.m);
+    tshared.n += (int)arg;
+    mutexunlock(&tshared.m);
+    if((p = malloc(64)) == 0){
+      printf(stdout, "thread test: malloc failed\n");
+      exit();
+    }
+    free(p);
+  }
+  if((int)arg == 1)
+    tshared.fd = open("README", 0);
+  exit();
+}
+
+// Threads share memory and open files, wait leaves them to join,
+// and join hands back their stacks.
+void
+threadtest(void)
+{
+  int pids[4], i, j, pid;
+  char c;
+
+  printf(stdout, "thread test\n");
+  if(join((void**)&pid) != -1 || clone(threadwork, 0, (void*)KERNBASE) != -1 ||
+     clone(threadwork, 0, (char*)&pid + 1) != -1){
+    printf(stdout, "thread test: bad arguments not caught\n");
+    exit();
+  }
+  mutexinit(&tshared.m);
+  tshared.n = 0;
+  tshared.fd = -1;
+  for(i = 0; i < 4; i++){
+    if((pids[i] = threadcreate(threadwork, (void*)(i + 1))) < 0){
+      printf(stdout, "thread test: threadcreate failed\n");
+      exit();
+    }
+  }
+  if(wait() != -1){
+    printf(stdout, "thread test: wait reaped a thread\n");
+    exit();
+  }
+  for(i = 0; i < 4; i++){
+    pid = threadjoin();
+    for(j = 0; j < 4 && pids[j] != pid; j++)
+      ;
+    if(j == 4){
+      printf(stdout, "thread test: join returned %d\n", pid);
+      exit();
+    }
+    pids[j] = -1;
+  }
+  if(threadjoin() != -1){
+    printf(stdout, "thread test: join with no threads left\n");
+    exit();
+  }
+  if(tshared.n != 500 * (1 + 2 + 3 + 4)){
+    printf(stdout, "thread test: lost updates, n = %d\n", tshared.n);
+    exit();
+  }
+  if(tshared.fd < 0 || read(tshared.fd, &c, 1) != 1){
+    printf(stdout, "thread test: file opened by a thread not shared\n");
+    exit();
+  }
+  close(tshared.fd);
+  printf(stdout, "thread test OK\n");
+}
+
+struct lockstatent lsent[64];
+
+// the counters move when locks are used, and reset clears them
+void
+lockstattest(void)
+{
+  struct lockstatent *e, *ptable, *buffer;
+  int fd, i, n;
+
+  printf(stdout, "lockstat test\n");
+  if(lockstat(0, 0) != 0 || lockstat(lsent, -1) != -1 || lockstat((void*)KERNBASE, 1) != -1){
+    printf(stdout, "lockstat test: bad arguments not caught\n");
+    exit();
+  }
+  for(i = 0; i < 10; i++){
+    if((fd = open("README", 0)) < 0){
+      printf(stdout, "lockstat test: open failed\n");
+      exit();
+    }
+    close(fd);
+  }
+  if(lockstat(lsent, 1) != 1 || (n = lockstat(lsent, 64)) <= 1){
+    printf(stdout, "lockstat test: no entries\n");
+    exit();
+  }
+  ptable = buffer = 0;
+  for(e = lsent; e < &lsent[n]; e++){
+    if(e->ncontended > e->nacquire || e->nspin > e->ncontended || e->nspinok > e->nspin){
+      printf(stdout, "lockstat test: %s contended more than taken\n", e->name);
+      exit();
+    }
+    if(!e->sleep && strcmp(e->name, "ptable") == 0)
+      ptable = e;
+    if(e->sleep && strcmp(e->name, "buffer") == 0)
+      buffer = e;
+  }
+  if(ptable == 0 || buffer == 0 || ptable->nacquire == 0 || buffer->nacquire < 10){
+    printf(stdout, "lockstat test: ptable or buffer not counted\n");
+    exit();
+  }
+  printf(stdout, "lockstat test OK\n");
+}
+
+// Make a system call with FL_TF set, as a debugger stepping over
+// the sysenter in a usys.S stub would.
+int
+stepgetpid(void)
+{
+  int res;
+  asm volatile("movl %%esp, %%ecx\n\t"
+      "movl $1f, %%edx\n\t"
+      "pushfl\n\t"
+      "orl $0x100, (%%esp)\n\t"
+      "popfl\n\t"
+      "sysenter\n"
+      "1:" :
+      "=a" (res) :
+      "a" (SYS_getpid) :
+      "ecx", "edx", "cc", "memory");
+  return res;
+}
+
+// the kernel must not panic on the debug trap sysenter takes,
+// and the child must come back without FL_TF.
+void
+steptest(void)
+{
+  int fds[2], pid;
+  char c;
+
+  printf(stdout, "single step syscall test\n");
+  if(pipe(fds) != 0){
+    printf(stdout, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(fds[0]);
+    if(stepgetpid() == getpid())
+      write(fds[1], "x", 1);
+    exit();
+  }
+  close(fds[1]);
+  if(read(fds[0], &c, 1) != 1){
+    printf(stdout, "single step syscall test failed\n");
+    exit();
+  }
+  close(fds[0]);
+  wait();
+  printf(stdout, "single step syscall test OK\n");
+}
+
 void
 validateint(int *p)
 {
@@ -1761,6 +2939,7 @@ main(int argc, char *argv[])
   linkunlink();
   concreate();
   fourfiles();
+  sharedreads();
   sharedfd();
 
   bigargtest();
@@ -1768,7 +2947,21 @@ main(int argc, char *argv[])
   bigargtest();
   bsstest();
   sbrktest();
+  stackgrowtest();
+  mmaptest();
+  shmtest();
+  rsstest();
+  swaptest();
+  vdatatest();
+  ringtest();
+  lockstattest();
+  pidtest();
+  countertest();
+  futextest();
+  semtest();
+  threadtest();
   validatetest();
+  steptest();
 
   opentest();
   writetest();
@@ -1781,6 +2974,9 @@ main(int argc, char *argv[])
 
   mem();
   pipe1();
+  pipebig();
+  splicetest();
+  sendfiletest();
   preempt();
   exitwait();
 